@@ -0,0 +1,674 @@
+#pragma once
+#include "Types.hpp"
+#include "CTTI.hpp"
+#include "ThreadPool.hpp"
+#include "soa_vector.hpp"
+#include "FilterTerms.hpp"
+#include "resource_ptr.hpp"
+#include <vector>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <unordered_map>
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <array>
+#include <tuple>
+#include <utility>
+#include <limits>
+
+class World;
+
+/**
+ Type-erased description of a component type. Used by storage that keeps several
+ component types side-by-side in raw memory instead of in a typed container.
+ */
+struct ComponentTypeInfo{
+    RavEngine::ctti_t id;
+    size_t size;
+    size_t alignment;
+    void(*moveConstruct)(void* dest, void* src);
+    void(*destruct)(void* ptr);
+    void(*swap)(void* a, void* b);
+    void(*moveToWorld)(void* src, World* dest, entity_t destLocalID);
+    void(*copyToWorld)(const void* src, World* dest, entity_t destLocalID);    // nullptr if the type is not copy constructible
+    size_t(*index)();   // the type's World::ComponentIndex
+};
+
+// defined in World.hpp, because moving into a world needs the complete World type
+template<typename T>
+const ComponentTypeInfo& GetComponentTypeInfo();
+
+/**
+ Archetype storage groups entities by their exact set of component types. Each group
+ (an Archetype) stores its entities in fixed-size chunks, with one contiguous column per
+ component type, so that iterating several components at once is a linear scan.
+ The ComponentTicks of each column are kept in a separate block per chunk, so that filters which don't check them
+ read the same dense columns as before. Tag columns, which are zero-width, have no ticks.
+ */
+class ArchetypeStorage{
+public:
+    constexpr static size_t chunk_bytes = 16 * 1024;
+    constexpr static size_t chunk_alignment = 64;
+    constexpr static size_t max_pooled_chunks = 64;
+
+    struct Chunk{
+        std::byte* data = nullptr;
+        ComponentTicks* ticks = nullptr;    // one column of capacity entries per component column that isn't a tag, or nullptr if all are tags
+        uint32_t count = 0;
+    };
+
+    struct Archetype{
+        std::pmr::vector<const ComponentTypeInfo*> types;   // sorted by id
+        std::pmr::vector<size_t> offsets;                   // byte offset of each column in a chunk. The owner column is always at 0.
+        std::pmr::vector<pos_t> tickColumns;                // the tick column of each column, or INVALID_INDEX for tags
+        size_t n_tickColumns = 0;
+        uint32_t capacity = 0;                          // rows per chunk
+        size_t bytes = 0;                               // bytes per chunk
+        std::pmr::vector<Chunk> chunks;
+        ComponentTicks* spareTicks = nullptr;           // the tick block of the last chunk that emptied, so a chunk that keeps filling and emptying doesn't reallocate it
+        std::pmr::unordered_map<RavEngine::ctti_t, Archetype*> addEdges, removeEdges;
+
+        Archetype(decltype(types)&& t, std::pmr::memory_resource* resource) : types(std::move(t), resource), offsets(resource), tickColumns(resource), chunks(resource), addEdges(resource), removeEdges(resource){
+            // make room for the owner column, then lay out each component column in order
+            size_t row_bytes = sizeof(entity_t);
+            size_t padding = 0;
+            for(auto type : types){
+                row_bytes += type->size;
+                padding += type->alignment;
+            }
+            capacity = static_cast<uint32_t>(std::max<size_t>((chunk_bytes - std::min(padding, chunk_bytes)) / row_bytes, 1));
+            size_t offset = sizeof(entity_t) * capacity;
+            for(auto type : types){
+                offset = (offset + type->alignment - 1) / type->alignment * type->alignment;
+                offsets.push_back(offset);
+                offset += std::max<size_t>(type->size * capacity, 1);   // a tag column still gets an address inside the chunk
+                tickColumns.push_back(type->size == 0 ? INVALID_INDEX : static_cast<pos_t>(n_tickColumns++));
+            }
+            bytes = std::max(offset, chunk_bytes);
+        }
+
+        ~Archetype(){
+            for(auto& chunk : chunks){
+                for(uint32_t row = 0; row < chunk.count; row++){
+                    for(pos_t col = 0; col < types.size(); col++){
+                        types[col]->destruct(Element(chunk, col, row));
+                    }
+                }
+                chunks.get_allocator().resource()->deallocate(chunk.data, bytes, chunk_alignment);
+                if (chunk.ticks != nullptr){
+                    chunks.get_allocator().resource()->deallocate(chunk.ticks, TickBytes(), alignof(ComponentTicks));
+                }
+            }
+            if (spareTicks != nullptr){
+                chunks.get_allocator().resource()->deallocate(spareTicks, TickBytes(), alignof(ComponentTicks));
+            }
+        }
+
+        // @return the column index of the type, or INVALID_INDEX if this archetype does not store it
+        inline pos_t ColumnOf(RavEngine::ctti_t id) const{
+            auto it = std::lower_bound(types.begin(), types.end(), id, [](const ComponentTypeInfo* info, RavEngine::ctti_t id){
+                return info->id < id;
+            });
+            if (it != types.end() && (*it)->id == id){
+                return static_cast<pos_t>(it - types.begin());
+            }
+            return INVALID_INDEX;
+        }
+
+        inline bool Contains(RavEngine::ctti_t id) const{
+            return PosIsValid(ColumnOf(id));
+        }
+
+        inline entity_t* Owners(const Chunk& chunk) const{
+            return reinterpret_cast<entity_t*>(chunk.data);
+        }
+
+        template<typename T>
+        inline T* Column(const Chunk& chunk, pos_t col) const{
+            return reinterpret_cast<T*>(chunk.data + offsets[col]);
+        }
+
+        inline void* Element(const Chunk& chunk, pos_t col, uint32_t row) const{
+            return chunk.data + offsets[col] + types[col]->size * row;
+        }
+        
+        inline bool HasTicks(pos_t col) const{
+            return PosIsValid(tickColumns[col]);
+        }
+        
+        // the column must not be a tag
+        inline ComponentTicks* Ticks(const Chunk& chunk, pos_t col) const{
+            return chunk.ticks + size_t(tickColumns[col]) * capacity;
+        }
+        
+        inline size_t TickBytes() const{
+            return sizeof(ComponentTicks) * capacity * n_tickColumns;
+        }
+    };
+
+    struct Location{
+        Archetype* archetype = nullptr;
+        uint32_t chunk = 0;
+        uint32_t row = 0;
+    };
+
+private:
+    std::pmr::memory_resource* resource;    // chunks, locations and every archetype are allocated from here
+    std::pmr::vector<resource_ptr<Archetype>> archetypes;
+    std::pmr::map<std::pmr::vector<RavEngine::ctti_t>, Archetype*> archetypeLookup;
+    std::pmr::vector<Location> locations;    // indexed by world-local id
+    std::pmr::vector<std::byte*> chunkPool;  // freed chunks of chunk_bytes, so that entities moving between archetypes don't thrash the heap
+    const tick_t* currentTick;  // the owning world's change tick
+
+    inline std::byte* AllocateChunk(size_t bytes){
+        if (bytes == chunk_bytes && !chunkPool.empty()){
+            auto data = chunkPool.back();
+            chunkPool.pop_back();
+            return data;
+        }
+        return static_cast<std::byte*>(resource->allocate(bytes, chunk_alignment));
+    }
+
+    inline void FreeChunk(std::byte* data, size_t bytes){
+        if (bytes == chunk_bytes && chunkPool.size() < max_pooled_chunks){
+            chunkPool.push_back(data);
+        }
+        else{
+            resource->deallocate(data, bytes, chunk_alignment);
+        }
+    }
+
+    inline Archetype* FindOrCreate(decltype(Archetype::types)&& types){
+        std::sort(types.begin(), types.end(), [](auto a, auto b){
+            return a->id < b->id;
+        });
+        std::pmr::vector<RavEngine::ctti_t> key(resource);
+        key.reserve(types.size());
+        for(auto type : types){
+            key.push_back(type->id);
+        }
+        auto it = archetypeLookup.find(key);
+        if (it != archetypeLookup.end()){
+            return it->second;
+        }
+        archetypes.push_back(make_resource_ptr<Archetype>(resource, std::move(types), resource));
+        auto arch = archetypes.back().get();
+        archetypeLookup.emplace(std::move(key), arch);
+        return arch;
+    }
+
+    inline Archetype* AddEdge(Archetype* from, const ComponentTypeInfo& info){
+        if (from == nullptr){
+            return FindOrCreate(decltype(Archetype::types)({&info}, resource));
+        }
+        auto it = from->addEdges.find(info.id);
+        if (it != from->addEdges.end()){
+            return it->second;
+        }
+        decltype(Archetype::types) types(from->types, resource);
+        types.push_back(&info);
+        auto to = FindOrCreate(std::move(types));
+        from->addEdges.emplace(info.id, to);
+        to->removeEdges.emplace(info.id, from);
+        return to;
+    }
+
+    inline Archetype* RemoveEdge(Archetype* from, const ComponentTypeInfo& info){
+        if (from->types.size() == 1){
+            return nullptr;
+        }
+        auto it = from->removeEdges.find(info.id);
+        if (it != from->removeEdges.end()){
+            return it->second;
+        }
+        decltype(Archetype::types) types(from->types, resource);
+        types.erase(types.begin() + from->ColumnOf(info.id));
+        auto to = FindOrCreate(std::move(types));
+        from->removeEdges.emplace(info.id, to);
+        to->addEdges.emplace(info.id, from);
+        return to;
+    }
+
+    // reserve a row at the end of the archetype. Component columns are left unconstructed.
+    inline Location AppendRow(Archetype* arch, entity_t local_id){
+        if (arch->chunks.empty() || arch->chunks.back().count == arch->capacity){
+            Chunk chunk;
+            chunk.data = AllocateChunk(arch->bytes);
+            if (arch->spareTicks != nullptr){
+                chunk.ticks = arch->spareTicks;
+                arch->spareTicks = nullptr;
+            }
+            else if (arch->n_tickColumns > 0){
+                chunk.ticks = static_cast<ComponentTicks*>(resource->allocate(arch->TickBytes(), alignof(ComponentTicks)));
+            }
+            arch->chunks.push_back(chunk);
+        }
+        auto& chunk = arch->chunks.back();
+        Location loc{arch, static_cast<uint32_t>(arch->chunks.size() - 1), chunk.count};
+        arch->Owners(chunk)[loc.row] = local_id;
+        chunk.count++;
+        return loc;
+    }
+
+    // fill the hole at loc with the last row of the archetype.
+    // The components at loc must already be destroyed or moved-from and destroyed.
+    inline void EraseRow(const Location& loc){
+        auto arch = loc.archetype;
+        auto& last = arch->chunks.back();
+        auto& chunk = arch->chunks[loc.chunk];
+        const uint32_t last_row = last.count - 1;
+        if (&chunk != &last || loc.row != last_row){
+            for(pos_t col = 0; col < arch->types.size(); col++){
+                auto src = arch->Element(last, col, last_row);
+                arch->types[col]->moveConstruct(arch->Element(chunk, col, loc.row), src);
+                arch->types[col]->destruct(src);
+                if (arch->HasTicks(col)){
+                    arch->Ticks(chunk, col)[loc.row] = arch->Ticks(last, col)[last_row];
+                }
+            }
+            auto moved = arch->Owners(last)[last_row];
+            arch->Owners(chunk)[loc.row] = moved;
+            locations[moved] = loc;
+        }
+        last.count--;
+        if (last.count == 0){
+            FreeChunk(last.data, arch->bytes);
+            if (arch->spareTicks == nullptr){
+                arch->spareTicks = last.ticks;
+            }
+            else if (last.ticks != nullptr){
+                resource->deallocate(last.ticks, arch->TickBytes(), alignof(ComponentTicks));
+            }
+            arch->chunks.pop_back();
+        }
+    }
+
+    // move the entity's row into another archetype. Columns not in the destination are destroyed.
+    // Columns only in the destination are left unconstructed.
+    inline Location Transfer(entity_t local_id, Archetype* dest){
+        auto src = locations[local_id];
+        Location loc;
+        if (dest != nullptr){
+            loc = AppendRow(dest, local_id);
+        }
+        if (src.archetype != nullptr){
+            auto arch = src.archetype;
+            auto& chunk = arch->chunks[src.chunk];
+            for(pos_t col = 0; col < arch->types.size(); col++){
+                auto ptr = arch->Element(chunk, col, src.row);
+                if (dest != nullptr){
+                    auto dest_col = dest->ColumnOf(arch->types[col]->id);
+                    if (PosIsValid(dest_col)){
+                        arch->types[col]->moveConstruct(dest->Element(dest->chunks[loc.chunk], dest_col, loc.row), ptr);
+                        if (arch->HasTicks(col)){
+                            dest->Ticks(dest->chunks[loc.chunk], dest_col)[loc.row] = arch->Ticks(chunk, col)[src.row];
+                        }
+                    }
+                }
+                arch->types[col]->destruct(ptr);
+            }
+            EraseRow(src);
+        }
+        locations[local_id] = loc;
+        return loc;
+    }
+
+    // swap two rows of an archetype, by row number across its chunks
+    inline void SwapRows(Archetype& arch, size_t a, size_t b){
+        const Location la{&arch, uint32_t(a / arch.capacity), uint32_t(a % arch.capacity)};
+        const Location lb{&arch, uint32_t(b / arch.capacity), uint32_t(b % arch.capacity)};
+        auto& ca = arch.chunks[la.chunk];
+        auto& cb = arch.chunks[lb.chunk];
+        for(pos_t col = 0; col < arch.types.size(); col++){
+            arch.types[col]->swap(arch.Element(ca, col, la.row), arch.Element(cb, col, lb.row));
+            if (arch.HasTicks(col)){
+                std::swap(arch.Ticks(ca, col)[la.row], arch.Ticks(cb, col)[lb.row]);
+            }
+        }
+        auto& oa = arch.Owners(ca)[la.row];
+        auto& ob = arch.Owners(cb)[lb.row];
+        std::swap(oa, ob);
+        locations[oa] = la;
+        locations[ob] = lb;
+    }
+    
+    inline void EnsureLocation(entity_t local_id){
+        if (local_id >= locations.size()){
+            locations.resize(local_id + 1);
+        }
+    }
+
+public:
+    /**
+     @param currentTick the change tick that emplaced components are stamped with
+     @param resource where chunks and bookkeeping are allocated
+     */
+    ArchetypeStorage(const tick_t* currentTick, std::pmr::memory_resource* resource = std::pmr::get_default_resource()) : resource(resource), archetypes(resource), archetypeLookup(resource), locations(resource), chunkPool(resource), currentTick(currentTick){}
+    ArchetypeStorage(const ArchetypeStorage&) = delete;
+    
+    ~ArchetypeStorage(){
+        for(auto data : chunkPool){
+            resource->deallocate(data, chunk_bytes, chunk_alignment);
+        }
+    }
+
+    template<typename T, typename ... A>
+    inline T& Emplace(entity_t local_id, A&& ... args){
+        auto& info = GetComponentTypeInfo<T>();
+        EnsureLocation(local_id);
+        auto from = locations[local_id].archetype;
+        assert(from == nullptr || !from->Contains(info.id));  // entity already has this component!
+        auto dest = AddEdge(from, info);
+        auto loc = Transfer(local_id, dest);
+        const auto col = dest->ColumnOf(info.id);
+        if constexpr (!std::is_empty_v<T>){
+            dest->Ticks(dest->chunks[loc.chunk], col)[loc.row] = {*currentTick, *currentTick};
+        }
+        return *new (dest->Element(dest->chunks[loc.chunk], col, loc.row)) T(std::forward<A>(args)...);
+    }
+
+    template<typename T>
+    inline void Destroy(entity_t local_id){
+        assert(Has<T>(local_id));   // Cannot destroy a component on an entity that does not have one!
+        Transfer(local_id, RemoveEdge(locations[local_id].archetype, GetComponentTypeInfo<T>()));
+    }
+
+    template<typename T>
+    inline bool Has(entity_t local_id) const{
+        return local_id < locations.size() && locations[local_id].archetype != nullptr && locations[local_id].archetype->Contains(RavEngine::CTTI<T>());
+    }
+
+    template<typename T>
+    inline T& Get(entity_t local_id){
+        auto& loc = locations[local_id];
+        auto arch = loc.archetype;
+        // every row of a tag column shares the column's address
+        return arch->template Column<T>(arch->chunks[loc.chunk], arch->ColumnOf(RavEngine::CTTI<T>()))[std::is_empty_v<T> ? 0 : loc.row];
+    }
+    
+    template<typename T>
+    inline ComponentTicks& GetTicks(entity_t local_id){
+        static_assert(!std::is_empty_v<T>, "Tags have no change ticks");
+        auto& loc = locations[local_id];
+        auto arch = loc.archetype;
+        return arch->Ticks(arch->chunks[loc.chunk], arch->ColumnOf(RavEngine::CTTI<T>()))[loc.row];
+    }
+
+    /**
+     Sort the rows of each archetype that stores T by cmp(const T&, const T&)
+     Every chunk but the last of an archetype is full, so row r is in chunk r / capacity.
+     */
+    template<typename T, typename Compare>
+    inline void Sort(const Compare& cmp){
+        const auto id = RavEngine::CTTI<T>();
+        for(auto& arch : archetypes){
+            const auto col = arch->ColumnOf(id);
+            if (!PosIsValid(col) || arch->chunks.empty()){
+                continue;
+            }
+            const auto capacity = arch->capacity;
+            auto at = [&](size_t r) -> T&{
+                return arch->template Column<T>(arch->chunks[r / capacity], col)[r % capacity];
+            };
+            std::pmr::vector<size_t> perm((arch->chunks.size() - 1) * capacity + arch->chunks.back().count, resource);
+            for(size_t i = 0; i < perm.size(); i++){
+                perm[i] = i;
+            }
+            std::sort(perm.begin(), perm.end(), [&](size_t a, size_t b){
+                return cmp(at(a), at(b));
+            });
+            // row j takes the row that was at perm[j]
+            for(size_t i = 0; i < perm.size(); i++){
+                auto j = i;
+                while(perm[j] != i){
+                    const auto k = perm[j];
+                    SwapRows(*arch, j, k);
+                    perm[j] = j;
+                    j = k;
+                }
+                perm[j] = j;
+            }
+        }
+    }
+    
+    // invoke f(const ComponentTypeInfo&) for each component type the entity has
+    template<typename func>
+    inline void EnumerateTypesOn(entity_t local_id, const func& f) const{
+        if (local_id < locations.size() && locations[local_id].archetype != nullptr){
+            for(auto type : locations[local_id].archetype->types){
+                f(*type);
+            }
+        }
+    }
+    
+    // destroy all the components owned by an entity
+    inline void DestroyEntity(entity_t local_id){
+        if (local_id < locations.size() && locations[local_id].archetype != nullptr){
+            Transfer(local_id, nullptr);
+        }
+    }
+
+    // move all the components on an entity in another storage into this one, under a new local id
+    inline void MoveFrom(ArchetypeStorage& other, entity_t other_local_id, entity_t local_id){
+        if (other_local_id >= other.locations.size() || other.locations[other_local_id].archetype == nullptr){
+            return;
+        }
+        auto src = other.locations[other_local_id];
+        auto dest = FindOrCreate(decltype(Archetype::types)(src.archetype->types, resource));
+        EnsureLocation(local_id);
+        auto loc = AppendRow(dest, local_id);
+        auto& src_chunk = src.archetype->chunks[src.chunk];
+        auto& dest_chunk = dest->chunks[loc.chunk];
+        // same signature means the same column order. Ticks don't carry across worlds, so the components count as added here.
+        for(pos_t col = 0; col < dest->types.size(); col++){
+            auto ptr = src.archetype->Element(src_chunk, col, src.row);
+            dest->types[col]->moveConstruct(dest->Element(dest_chunk, col, loc.row), ptr);
+            dest->types[col]->destruct(ptr);
+            if (dest->HasTicks(col)){
+                dest->Ticks(dest_chunk, col)[loc.row] = {*currentTick, *currentTick};
+            }
+        }
+        other.EraseRow(src);
+        other.locations[other_local_id] = Location();
+        locations[local_id] = loc;
+    }
+
+    // move all the components on an entity into a world that may use a different storage kind
+    inline void MoveTo(entity_t local_id, World* dest, entity_t dest_local_id){
+        if (local_id >= locations.size() || locations[local_id].archetype == nullptr){
+            return;
+        }
+        auto src = locations[local_id];
+        auto arch = src.archetype;
+        for(pos_t col = 0; col < arch->types.size(); col++){
+            arch->types[col]->moveToWorld(arch->Element(arch->chunks[src.chunk], col, src.row), dest, dest_local_id);
+        }
+        DestroyEntity(local_id);
+    }
+
+    // @return true if every component on the entity can be copied
+    inline bool CanCopy(entity_t local_id) const{
+        if (local_id >= locations.size() || locations[local_id].archetype == nullptr){
+            return true;
+        }
+        const auto& types = locations[local_id].archetype->types;
+        return std::all_of(types.begin(), types.end(), [](const ComponentTypeInfo* info){
+            return info->copyToWorld != nullptr;
+        });
+    }
+    
+    // copy all the components on an entity onto an entity in any world, which may be this one
+    inline void CopyTo(entity_t local_id, World* dest, entity_t dest_local_id){
+        if (local_id >= locations.size() || locations[local_id].archetype == nullptr){
+            return;
+        }
+        const auto arch = locations[local_id].archetype;
+        for(pos_t col = 0; col < arch->types.size(); col++){
+            // look the row up again each time, copying into this storage can grow the archetype's chunk list
+            const auto& src = locations[local_id];
+            arch->types[col]->copyToWorld(arch->Element(arch->chunks[src.chunk], col, src.row), dest, dest_local_id);
+        }
+    }
+
+    /**
+     Make room for more entities in the same archetype as an existing entity
+     @param local_id the entity whose archetype to grow
+     @param n_more the number of entities that will be added
+     @param max_local_id the highest local id that will be added
+     */
+    inline void Reserve(entity_t local_id, size_t n_more, entity_t max_local_id){
+        if (max_local_id >= locations.size()){
+            locations.reserve(max_local_id + 1);
+        }
+        if (local_id >= locations.size() || locations[local_id].archetype == nullptr){
+            return;
+        }
+        auto arch = locations[local_id].archetype;
+        arch->chunks.reserve(arch->chunks.size() + (n_more + arch->capacity - 1) / arch->capacity);
+    }
+    
+    // A are filter terms. See World::Filter.
+    // @param resources the world's resource for each Resource term, in declared order
+    template<typename ... A, typename func>
+    inline void Filter(const func& f, const std::array<void*, sizeof ... (A)>& resources, tick_t since){
+        std::array<pos_t, sizeof ... (A)> cols;
+        for(auto& arch : archetypes){
+            if (!MatchColumns<A...>(*arch, cols)){
+                continue;
+            }
+            for(const auto& chunk : arch->chunks){
+                FilterChunk<A...>(f, *arch, chunk, cols, resources, since, std::index_sequence_for<A...>{});
+            }
+        }
+    }
+    
+    // invoke f(count, owners, A* ...) on each chunk that stores all of A, with the local ids of the chunk's entities
+    template<typename ... A, typename func>
+    inline void FilterChunks(const func& f){
+        std::array<pos_t, sizeof ... (A)> cols;
+        for(auto& arch : archetypes){
+            if (!MatchColumns<A...>(*arch, cols)){
+                continue;
+            }
+            for(const auto& chunk : arch->chunks){
+                ChunkColumns<A...>(f, *arch, chunk, cols, std::index_sequence_for<A...>{});
+            }
+        }
+    }
+    
+    // run a filter over the matching chunks on a thread pool. Each task is a run of whole chunks.
+    // @param scratch where the list of chunks is allocated
+    template<typename ... A, typename func>
+    inline void ParallelFilter(const func& f, const std::array<void*, sizeof ... (A)>& resources, size_t grainSize, ThreadPool& pool, tick_t since, std::pmr::memory_resource* scratch){
+        struct ChunkRef{
+            const Archetype* arch;
+            const Chunk* chunk;
+            std::array<pos_t, sizeof ... (A)> cols;
+        };
+        std::pmr::vector<ChunkRef> work(scratch);
+        uint32_t min_capacity = std::numeric_limits<uint32_t>::max();
+        std::array<pos_t, sizeof ... (A)> cols;
+        for(auto& arch : archetypes){
+            if (!MatchColumns<A...>(*arch, cols)){
+                continue;
+            }
+            for(const auto& chunk : arch->chunks){
+                work.push_back({arch.get(), &chunk, cols});
+            }
+            min_capacity = std::min(min_capacity, arch->capacity);
+        }
+        pool.ParallelFor(0, work.size(), std::max<size_t>(grainSize / min_capacity, 1), [&](size_t begin, size_t end){
+            for(size_t i = begin; i < end; i++){
+                FilterChunk<A...>(f, *work[i].arch, *work[i].chunk, work[i].cols, resources, since, std::index_sequence_for<A...>{});
+            }
+        });
+    }
+
+private:
+    // @return true if the archetype matches the filter terms A, and writes the column index of each into cols.
+    // Excluded terms, resource terms, and optional terms the archetype doesn't store, get INVALID_INDEX.
+    template<typename ... A>
+    inline bool MatchColumns(const Archetype& arch, std::array<pos_t, sizeof ... (A)>& cols) const{
+        const std::array<RavEngine::ctti_t, sizeof ... (A)> ids{RavEngine::CTTI<term_component_t<A>>()...};
+        constexpr std::array<bool, sizeof ... (A)> required{term_required<A>...};
+        constexpr std::array<bool, sizeof ... (A)> excluded{filter_term<A>::excluded...};
+        constexpr std::array<bool, sizeof ... (A)> resource{filter_term<A>::resource...};
+        for(size_t i = 0; i < ids.size(); i++){
+            cols[i] = resource[i] ? INVALID_INDEX : arch.ColumnOf(ids[i]);
+            if (required[i] && !PosIsValid(cols[i])){
+                return false;
+            }
+            if (excluded[i] && PosIsValid(cols[i])){
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    // @return what the callback receives for a term, as a tuple of zero or one parameters
+    template<typename T>
+    static inline auto ChunkArg(term_component_t<T>* column, uint32_t row){
+        if constexpr (!term_passes_arg<T>){
+            return std::tuple<>();
+        }
+        else if constexpr (filter_term<T>::resource){
+            return std::tuple<term_component_t<T>&>(*column);
+        }
+        else if constexpr (filter_term<T>::optional){
+            return std::tuple<term_component_t<T>*>(column != nullptr ? column + (std::is_empty_v<term_component_t<T>> ? 0 : row) : nullptr);
+        }
+        else{
+            return std::tuple<component_ref_t<term_component_t<T>>>(component_ref_t<term_component_t<T>>(column[row]));
+        }
+    }
+    
+    template<typename T>
+    static inline bool RowTicksPass(const ComponentTicks* ticks, uint32_t row, tick_t since){
+        if constexpr (term_checks_ticks<T>){
+            return ticks == nullptr || term_ticks_pass<T>(ticks[row], since);
+        }
+        else{
+            return true;
+        }
+    }
+    
+    template<typename T>
+    inline void RowMark(ComponentTicks* ticks, uint32_t row) const{
+        if constexpr (filter_term<T>::marks){
+            if (ticks != nullptr){
+                term_mark<T>(ticks[row], *currentTick);
+            }
+        }
+    }
+    
+    template<typename ... A, typename func, typename cols_t, size_t ... I>
+    inline void ChunkColumns(const func& f, const Archetype& arch, const Chunk& chunk, const cols_t& cols, std::index_sequence<I...>){
+        if (chunk.count > 0){
+            f(size_t(chunk.count), arch.Owners(chunk), arch.template Column<A>(chunk, cols[I])...);
+        }
+    }
+    
+    template<typename ... A, typename func, typename cols_t, size_t ... I>
+    inline void FilterChunk(const func& f, const Archetype& arch, const Chunk& chunk, const cols_t& cols, const std::array<void*, sizeof ... (A)>& resources, tick_t since, std::index_sequence<I...>){
+        const std::tuple<term_component_t<A>*...> columns{filter_term<A>::resource ? static_cast<term_component_t<A>*>(resources[I]) : PosIsValid(cols[I]) ? arch.template Column<term_component_t<A>>(chunk, cols[I]) : nullptr...};
+        // only terms that check or mark ticks get them. Others, and optional terms the archetype doesn't store, get nullptr.
+        const std::array<ComponentTicks*, sizeof ... (A)> ticks{(term_checks_ticks<A> || filter_term<A>::marks) && PosIsValid(cols[I]) ? arch.Ticks(chunk, cols[I]) : nullptr...};
+        for(uint32_t row = 0; row < chunk.count; row++){
+            if constexpr ((term_checks_ticks<A> || ...)){
+                if (!(RowTicksPass<A>(ticks[I], row, since) && ...)){
+                    continue;
+                }
+            }
+            (RowMark<A>(ticks[I], row), ...);
+            if constexpr ((term_direct<A> && ...)){
+                f(component_ref_t<term_component_t<A>>(std::get<I>(columns)[row])...);
+            }
+            else{
+                std::apply(f, std::tuple_cat(ChunkArg<A>(std::get<I>(columns), row)...));
+            }
+        }
+    }
+};
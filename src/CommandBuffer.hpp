@@ -0,0 +1,276 @@
+#pragma once
+#include "World.hpp"
+#include "Registry.hpp"
+#include "Entity.hpp"
+#include <vector>
+#include <utility>
+#include <cassert>
+
+/**
+ Records structural changes to a world, to play back later with World::Apply. Use one to create or destroy
+ entities and components from inside a Filter, or one per thread to queue changes from parallel systems without
+ locking, then Merge them and apply them once per frame.
+ Commands are played back in bulk, in this order:
+ 1. creates, in the order they were recorded
+ 2. for each component type, its emplaces and removals in the order they were recorded, so that removing
+    and then emplacing a component replaces it
+ 3. entity destroys
+ Commands that target an entity which has been destroyed in the meantime are skipped, as are removals of a component
+ that the entity no longer has, for example because two merged buffers both removed it.
+ */
+class CommandBuffer{
+
+    // the queued commands for one component type
+    template<typename T>
+    struct TypeCommands{
+        std::vector<std::pair<entity_id_t, T>> emplaces;
+        std::vector<std::pair<entity_id_t, size_t>> removals;   // with the number of emplaces recorded before each, to replay them in order
+    };
+
+    struct TypeOps{
+        void(*apply)(void* commands, World& world, const std::vector<entity_id_t>& created);
+        void(*remap)(void* commands, entity_t createOffset);
+        void(*append)(void* into, void* from);
+        void(*destroy)(void* commands);
+    };
+
+    // owns the commands for one type, erased
+    struct TypeQueue{
+        size_t index;   // World::ComponentIndex of the type
+        void* commands = nullptr;
+        const TypeOps* ops = nullptr;
+
+        TypeQueue(size_t index, void* commands, const TypeOps* ops) : index(index), commands(commands), ops(ops){}
+        TypeQueue(const TypeQueue&) = delete;
+        TypeQueue(TypeQueue&& other) : index(other.index), commands(other.commands), ops(other.ops){
+            other.commands = nullptr;
+        }
+        ~TypeQueue(){
+            if (commands != nullptr){
+                ops->destroy(commands);
+            }
+        }
+    };
+
+    std::vector<entity_id_t(*)(World&)> creates;
+    std::vector<entity_id_t> destroys;
+    std::vector<TypeQueue> types;
+    std::vector<pos_t> typeIndex;   // position in types, indexed by World::ComponentIndex
+
+    // entities that are not created yet are stored with no index, and their create number where the generation would be
+    static inline entity_id_t MakePending(entity_t createNumber){
+        return MakeEntityID(INVALID_ENTITY, createNumber);
+    }
+
+    static inline bool IsPending(entity_id_t id){
+        return !EntityIsValid(EntityIndex(id));
+    }
+
+    static inline entity_id_t Resolve(entity_id_t id, const std::vector<entity_id_t>& created){
+        return IsPending(id) ? created[EntityGeneration(id)] : id;
+    }
+
+    static inline void Remap(entity_id_t& id, entity_t createOffset){
+        if (IsPending(id)){
+            id = MakePending(EntityGeneration(id) + createOffset);
+        }
+    }
+
+    template<typename T>
+    static void ApplyType(void* ptr, World& world, const std::vector<entity_id_t>& created){
+        auto& commands = *static_cast<TypeCommands<T>*>(ptr);
+        // play back the removals that were recorded before the emplace at position n
+        size_t next_removal = 0;
+        auto removeUntil = [&](size_t n){
+            for(; next_removal < commands.removals.size() && commands.removals[next_removal].second <= n; next_removal++){
+                const auto id = Resolve(commands.removals[next_removal].first, created);
+                if (Registry::IsAlive(id) && Registry::HasComponent<T>(id)){
+                    Registry::DestroyComponent<T>(id);
+                }
+            }
+        };
+        if (!commands.emplaces.empty()){
+            // resolve and grow the set once for the whole batch
+            decltype(world.MakeIfNotExists<T>()) set = nullptr;
+            const auto index = World::ComponentIndex<T>();
+            if (world.storageMode == WorldStorage::SparseSet && !world.localToGlobal.empty()){
+                set = world.template MakeIfNotExists<T>();
+                set->Reserve(commands.emplaces.size(), static_cast<entity_t>(world.localToGlobal.size() - 1));
+            }
+            for(size_t i = 0; i < commands.emplaces.size(); i++){
+                removeUntil(i);
+                auto& pair = commands.emplaces[i];
+                const auto id = Resolve(pair.first, created);
+                if (!Registry::IsAlive(id)){
+                    continue;
+                }
+                auto& data = Registry::entityData[EntityIndex(id)];
+                const bool local = set != nullptr && data.world == &world;
+                if (local ? set->HasComponent(data.idInWorld) : data.world->template HasComponent<T>(data.idInWorld)){
+                    assert(false);  // the entity already has this component! Record a DestroyComponent before the Emplace to replace it.
+                    continue;
+                }
+                if (local){
+                    world.RecordEvent(index, ComponentEvent::Added, data.idInWorld);
+                    set->Emplace(data.idInWorld, std::move(pair.second));
+                }
+                else{
+                    data.world->template EmplaceComponent<T>(data.idInWorld, std::move(pair.second));
+                }
+            }
+        }
+        removeUntil(commands.emplaces.size());
+    }
+
+    template<typename T>
+    static void RemapType(void* ptr, entity_t createOffset){
+        auto& commands = *static_cast<TypeCommands<T>*>(ptr);
+        for(auto& pair : commands.emplaces){
+            Remap(pair.first, createOffset);
+        }
+        for(auto& pair : commands.removals){
+            Remap(pair.first, createOffset);
+        }
+    }
+
+    template<typename T>
+    static void AppendType(void* into, void* from){
+        auto& a = *static_cast<TypeCommands<T>*>(into);
+        auto& b = *static_cast<TypeCommands<T>*>(from);
+        // b's removals come after all of a's emplaces
+        for(auto& pair : b.removals){
+            a.removals.emplace_back(pair.first, pair.second + a.emplaces.size());
+        }
+        a.emplaces.insert(a.emplaces.end(), std::make_move_iterator(b.emplaces.begin()), std::make_move_iterator(b.emplaces.end()));
+    }
+
+    template<typename T>
+    static void DestroyType(void* ptr){
+        delete static_cast<TypeCommands<T>*>(ptr);
+    }
+
+    // @return the position of the type's queue in types, or INVALID_INDEX if it has none
+    inline pos_t FindQueue(size_t index) const{
+        return index < typeIndex.size() ? typeIndex[index] : INVALID_INDEX;
+    }
+
+    inline void AddQueue(TypeQueue&& queue){
+        if (queue.index >= typeIndex.size()){
+            typeIndex.resize(queue.index + 1, INVALID_INDEX);
+        }
+        typeIndex[queue.index] = static_cast<pos_t>(types.size());
+        types.push_back(std::move(queue));
+    }
+
+    template<typename T>
+    inline TypeCommands<T>& GetCommands(){
+        const auto index = World::ComponentIndex<T>();
+        auto pos = FindQueue(index);
+        if (!PosIsValid(pos)){
+            static constexpr TypeOps ops{&ApplyType<T>, &RemapType<T>, &AppendType<T>, &DestroyType<T>};
+            pos = static_cast<pos_t>(types.size());
+            AddQueue(TypeQueue(index, new TypeCommands<T>(), &ops));
+        }
+        return *static_cast<TypeCommands<T>*>(types[pos].commands);
+    }
+
+    template<typename T>
+    static entity_id_t CreateOne(World& world){
+        return world.CreatePrototype<T>().id;
+    }
+
+public:
+    CommandBuffer() = default;
+    CommandBuffer(const CommandBuffer&) = delete;
+    CommandBuffer(CommandBuffer&&) = default;
+    CommandBuffer& operator=(CommandBuffer&&) = default;
+
+    /**
+     Record the creation of an entity of prototype T
+     @return a placeholder that can be passed to Emplace, DestroyComponent and Destroy on this buffer. It is not a valid entity.
+     */
+    template<typename T = Entity>
+    inline Entity Create(){
+        creates.push_back(&CreateOne<T>);
+        return Entity(MakePending(static_cast<entity_t>(creates.size() - 1)));
+    }
+
+    /**
+     Record the construction of a component. The component is constructed now and moved into the world when the buffer is applied.
+     @param target an entity, or a placeholder returned by Create
+     */
+    template<typename T, typename ... A>
+    inline void Emplace(Entity target, A&& ... args){
+        static_assert(!std::is_same_v<T, Hierarchy>, "Use SetParent to place an entity in the hierarchy");
+        GetCommands<T>().emplaces.emplace_back(std::piecewise_construct, std::forward_as_tuple(target.id), std::forward_as_tuple(std::forward<A>(args)...));
+    }
+
+    template<typename T>
+    inline void DestroyComponent(Entity target){
+        auto& commands = GetCommands<T>();
+        commands.removals.emplace_back(target.id, commands.emplaces.size());
+    }
+
+    inline void Destroy(Entity target){
+        destroys.push_back(target.id);
+    }
+
+    /**
+     Move all of the commands in another buffer to the end of this one, for example to combine the buffers of several threads.
+     */
+    inline void Merge(CommandBuffer&& other){
+        const auto createOffset = static_cast<entity_t>(creates.size());
+        creates.insert(creates.end(), other.creates.begin(), other.creates.end());
+        for(auto id : other.destroys){
+            Remap(id, createOffset);
+            destroys.push_back(id);
+        }
+        for(auto& queue : other.types){
+            queue.ops->remap(queue.commands, createOffset);
+        }
+        for(auto& queue : other.types){
+            const auto pos = FindQueue(queue.index);
+            if (!PosIsValid(pos)){
+                AddQueue(std::move(queue));
+            }
+            else{
+                queue.ops->append(types[pos].commands, queue.commands);
+            }
+        }
+        other.Clear();
+    }
+
+    inline bool Empty() const{
+        return creates.empty() && destroys.empty() && types.empty();
+    }
+
+    inline void Clear(){
+        creates.clear();
+        destroys.clear();
+        types.clear();
+        typeIndex.clear();
+    }
+
+private:
+    friend class World;
+
+    inline std::vector<Entity> Apply(World& world){
+        std::vector<entity_id_t> created;
+        created.reserve(creates.size());
+        for(auto create : creates){
+            created.push_back(create(world));
+        }
+        for(auto& queue : types){
+            queue.ops->apply(queue.commands, world, created);
+        }
+        for(auto id : destroys){
+            Registry::DestroyEntity(Resolve(id, created));
+        }
+        Clear();
+        return std::vector<Entity>(created.begin(), created.end());
+    }
+};
+
+inline std::vector<Entity> World::Apply(CommandBuffer& buffer){
+    return buffer.Apply(*this);
+}
@@ -7,9 +7,13 @@ class ComponentHandle{
 public:
     ComponentHandle(decltype(owner) owner) : owner(owner){}
     
+    // @return the component, or nullptr if the owner has been destroyed or no longer has one
     inline T* operator->(){
-        assert(EntityIsValid(owner.id));
-        assert(owner.HasComponent<T>());
-        return &owner.GetComponent<T>();
+        return owner.TryGetComponent<T>();
+    }
+    
+    // @return false if the owner has been destroyed, even if its id has been reused
+    inline bool IsValid() const{
+        return owner.IsValid();
     }
 };
@@ -5,14 +5,14 @@
 struct World;
 
 struct Entity{
-    entity_t id = INVALID_ENTITY;
+    entity_id_t id = INVALID_ENTITY_ID;
     
-    Entity(entity_t id) : id(id){}
+    Entity(entity_id_t id) : id(id){}
     Entity(){}
     
     template<typename T, typename ... A>
-    inline T& EmplaceComponent(A ... args){
-        return Registry::EmplaceComponent<T>(id, args...);
+    inline component_ref_t<T> EmplaceComponent(A&& ... args){
+        return Registry::EmplaceComponent<T>(id, std::forward<A>(args)...);
     }
     
     template<typename T>
@@ -26,22 +26,74 @@ struct Entity{
     }
 
     template<typename T>
-    inline T& GetComponent() {
+    inline component_ref_t<T> GetComponent() {
        return Registry::GetComponent<T>(id);
     }
     
+    // stamp the component with the world's change tick, after writing to it through GetComponent
+    template<typename T>
+    inline void MarkChanged() {
+        Registry::MarkChanged<T>(id);
+    }
+    
+    // @return the component, or nullptr if this entity has been destroyed or does not have one
+    template<typename T>
+    inline T* TryGetComponent() {
+       return Registry::TryGetComponent<T>(id);
+    }
+    
+    // @return false once this entity has been destroyed, even if its id has been reused
+    inline bool IsValid() const{
+        return EntityIsValid(id);
+    }
+    
+    // destroy this entity, along with its children and their descendants
     inline void Destroy(){
         Registry::DestroyEntity(id);
     }
+    
+    /**
+     Make this entity the last-added child of parent, in the same world. Its own children come along.
+     Reparenting a subtree updates the depth of each entity in it.
+     */
+    inline void SetParent(Entity parent){
+        Registry::SetParent(id, parent.id);
+    }
+    
+    // detach this entity from its parent, making it the root of its subtree
+    inline void RemoveParent(){
+        Registry::SetParent(id, INVALID_ENTITY_ID);
+    }
+    
+    // @return the parent, or an invalid entity if this entity is a root or is not in the hierarchy
+    inline Entity GetParent(){
+        auto h = TryGetComponent<Hierarchy>();
+        return Entity(h != nullptr ? h->parent : INVALID_ENTITY_ID);
+    }
+    
+    // invoke f(Entity) on each child, newest first. f must not change the hierarchy.
+    template<typename func>
+    inline void ForEachChild(const func& f){
+        auto h = TryGetComponent<Hierarchy>();
+        for(auto child = h != nullptr ? h->firstChild : INVALID_ENTITY_ID; child != INVALID_ENTITY_ID; child = Registry::GetComponent<Hierarchy>(child).nextSibling){
+            f(Entity(child));
+        }
+    }
 
     inline World* GetWorld() const {
         return Registry::GetWorld(id);
     }
     
+    // move this entity and its descendants to another world. If it has a parent, it leaves the parent behind.
     inline void MoveTo(World& newWorld){
         Registry::MoveEntityToWorld(id, newWorld);
     }
     
+    // @return a new entity in the same world, with a copy of each of this entity's components. Aborts if one of them is not copy constructible.
+    inline Entity Clone() const{
+        return Entity(Registry::CloneEntity(id));
+    }
+    
     // default create impl
     // define your own to hide this one
     inline void Create(){}
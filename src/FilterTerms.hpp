@@ -0,0 +1,118 @@
+#pragma once
+#include "Types.hpp"
+#include <type_traits>
+
+/**
+ Filter terms wrap a component type to change how a Filter matches it.
+ - Added<T>: only entities whose T was emplaced after the filter's since tick
+ - Changed<T>: only entities whose T was emplaced or marked changed after the filter's since tick
+ - Mut<T>: every entity with a T, and each visited T is marked changed
+ - Without<T>: only entities that do not have a T. The callback does not receive a parameter for it.
+ - Optional<T>: entities with or without a T. The callback receives a T*, which is nullptr if the entity has none.
+ - Resource<T>: not a component. The callback receives the world's T resource, which is looked up once per filter.
+   If the world has no T resource, the filter visits nothing.
+ A filter needs at least one term that is not Without, Optional or Resource, to drive the loop.
+ Tags, which are empty component types, only filter. The callback does not receive a parameter for them, unless they are Optional.
+ Tags are stored as membership only, without ticks, so they cannot be wrapped in Added, Changed or Mut.
+ */
+template<typename T>
+struct Added{};
+
+template<typename T>
+struct Changed{};
+
+template<typename T>
+struct Mut{};
+
+template<typename T>
+struct Without{};
+
+template<typename T>
+struct Optional{};
+
+template<typename T>
+struct Resource{};
+
+template<typename T>
+struct filter_term{
+    using component = T;
+    constexpr static bool added = false;
+    constexpr static bool changed = false;
+    constexpr static bool marks = false;
+    constexpr static bool excluded = false;
+    constexpr static bool optional = false;
+    constexpr static bool resource = false;
+};
+
+template<typename T>
+struct filter_term<Added<T>> : filter_term<T>{
+    static_assert(!std::is_empty_v<typename filter_term<T>::component>, "Tags have no change ticks");
+    constexpr static bool added = true;
+};
+
+template<typename T>
+struct filter_term<Changed<T>> : filter_term<T>{
+    static_assert(!std::is_empty_v<typename filter_term<T>::component>, "Tags have no change ticks");
+    constexpr static bool changed = true;
+};
+
+template<typename T>
+struct filter_term<Mut<T>> : filter_term<T>{
+    static_assert(!std::is_empty_v<typename filter_term<T>::component>, "Tags have no change ticks");
+    constexpr static bool marks = true;
+};
+
+template<typename T>
+struct filter_term<Without<T>> : filter_term<T>{
+    constexpr static bool excluded = true;
+};
+
+template<typename T>
+struct filter_term<Optional<T>> : filter_term<T>{
+    constexpr static bool optional = true;
+};
+
+template<typename T>
+struct filter_term<Resource<T>> : filter_term<T>{
+    constexpr static bool resource = true;
+};
+
+// the component type a filter term refers to
+template<typename T>
+using term_component_t = typename filter_term<T>::component;
+
+// must an entity have the term's component to match?
+template<typename T>
+constexpr bool term_required = !filter_term<T>::excluded && !filter_term<T>::optional && !filter_term<T>::resource;
+
+// does the callback receive a parameter for the term?
+template<typename T>
+constexpr bool term_passes_arg = !filter_term<T>::excluded && !(term_required<T> && std::is_empty_v<term_component_t<T>>);
+
+// is the term a required component that is passed to the callback as it is?
+template<typename T>
+constexpr bool term_direct = term_required<T> && term_passes_arg<T>;
+
+// does the term only match some of the entities that have its component?
+template<typename T>
+constexpr bool term_checks_ticks = filter_term<T>::added || filter_term<T>::changed;
+
+template<typename T>
+inline bool term_ticks_pass(const ComponentTicks& ticks, tick_t since){
+    if constexpr (filter_term<T>::added){
+        return ticks.added > since;
+    }
+    else if constexpr (filter_term<T>::changed){
+        return ticks.changed > since;
+    }
+    else{
+        return true;
+    }
+}
+
+template<typename T>
+inline void term_mark(ComponentTicks& ticks, tick_t tick){
+    if constexpr (filter_term<T>::marks){
+        ticks.changed = tick;
+    }
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include "Types.hpp"
+#include "CTTI.hpp"
+
+/**
+ The place of an entity in its world's parent/child hierarchy. Every entity that has a parent or children has one.
+ Links are global ids, so they stay valid when a subtree moves to another world.
+ Read it in filters, but change it only through Entity::SetParent and Entity::RemoveParent.
+ In sparse-set storage, the Hierarchy set is kept in depth order, and a Filter with a Hierarchy term walks that order,
+ so each entity is visited after its parent. In archetype storage, entities are visited archetype by archetype.
+ */
+struct Hierarchy : public RavEngine::AutoCTTI{
+    entity_id_t parent = INVALID_ENTITY_ID;
+    entity_id_t firstChild = INVALID_ENTITY_ID;
+    entity_id_t nextSibling = INVALID_ENTITY_ID;
+    uint32_t depth = 0;     // 0 for roots
+};
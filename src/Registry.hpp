@@ -1,46 +1,322 @@
 #pragma once
 #include "Types.hpp"
-#include <queue>
+#include "implicit_free_list.hpp"
+#include "segmented_array.hpp"
 #include <vector>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
 #include "World.hpp"
 #include <cassert>
 
 struct World;
 
+/**
+ The Registry hands out the global ids of entities in every world, and maps them to their worlds.
+ Worlds on different threads can create and destroy entities concurrently:
+ - Each thread takes fresh ids from its own block, and reuses the ids it released, without synchronizing.
+   Only whole blocks of ids are passed between threads, through a shared pool.
+ - Entity data is kept in a segmented array, which never moves, so lookups are wait-free while other threads grow it.
+ An entity must only be accessed from one thread at a time, but any thread may check whether an id is alive.
+ */
 class Registry{
     
     friend class World;
     friend class Entity;
+    friend class CommandBuffer;
     
+    // zeroed until the slot is first used
     struct EntityData{
-        World* world = nullptr;
-        entity_t idInWorld = INVALID_ENTITY;
-        EntityData(decltype(world) w, decltype(idInWorld) i) : world(w), idInWorld(i){}
+        World* world;       // nullptr while the slot is free
+        entity_t idInWorld;
+        // incremented when the slot is taken and again when it is released, so it is odd exactly while the slot is alive,
+        // and old ids stop matching. Liveness is decided by it alone, so a stale id may be checked on one thread
+        // while another thread reuses the slot. Only the slot's owner writes it.
+        std::atomic<generation_t> generation;
     };
     
-    static std::queue<entity_t> available;
-    static std::vector<EntityData> entityData;
+    // released slots linked through idInWorld, as passed between threads
+    struct Chain{
+        entity_t head = INVALID_ENTITY;
+        size_t size = 0;
+    };
     
-    // invoked by the world
-    static inline entity_t CreateEntity(World* world, const entity_t idInWorld){
-        entity_t id;
-        if (available.size() > 0){
-            id = available.front();
-            available.pop();
-            auto& data = entityData[id];
-            data.idInWorld = idInWorld;
-            data.world = world;
+    // the ids one thread hands out
+    struct IDCache{
+        // LIFO order: the most recently released slots, at most a block of them, and the full block released before those.
+        // When another block fills up, the older one goes to the shared pool.
+        Chain recent, older;
+        // LowestFirst order: released slots are linked into unsorted, then sorted into lowest, in ascending order,
+        // the next time one is taken. A batch of releases costs a merge sort of the batch and one merge.
+        Chain lowest, unsorted;
+        entity_t lowestTail = INVALID_ENTITY;
+        size_t n_released = 0;
+        entity_t fresh = 0, freshEnd = 0;   // the rest of this thread's block of never-used ids
+        IDReuse order = IDReuse::LIFO;      // the order the released slots are kept in
+        
+        // give everything back to the shared pool when the thread exits
+        ~IDCache();
+    };
+    
+    constexpr static entity_t id_block_size = 1024;
+    
+    static segmented_array<EntityData> entityData;
+    static std::atomic<entity_t> nextFresh;     // the first id of the next fresh block
+    static std::atomic<IDReuse> reuseOrder;
+    static std::mutex sharedMtx;
+    static std::vector<Chain> sharedReleased;   // blocks of released slots that a thread had too many of, or left behind when it exited
+    static std::atomic<size_t> nShared;         // sharedReleased.size(), to check without locking
+    
+    static inline IDCache& LocalIDs(){
+        static thread_local IDCache cache;
+        return cache;
+    }
+    
+    static inline void GiveShared(const Chain& chain){
+        std::lock_guard<std::mutex> lk(sharedMtx);
+        sharedReleased.push_back(chain);
+        nShared.store(sharedReleased.size(), std::memory_order_relaxed);
+    }
+    
+    static inline void PushReleased(IDCache& cache, entity_t index){
+        if (cache.order == IDReuse::LIFO){
+            if (cache.recent.size == id_block_size){
+                if (cache.older.size > 0){
+                    GiveShared(cache.older);
+                    cache.n_released -= cache.older.size;
+                }
+                cache.older = cache.recent;
+                cache.recent = {};
+            }
+            entityData[index].idInWorld = cache.recent.head;
+            cache.recent = {index, cache.recent.size + 1};
+        }
+        else{
+            entityData[index].idInWorld = cache.unsorted.head;
+            cache.unsorted = {index, cache.unsorted.size + 1};
+        }
+        cache.n_released++;
+    }
+    
+    static inline entity_t PopReleased(IDCache& cache){
+        entity_t index;
+        if (cache.order == IDReuse::LIFO){
+            if (cache.recent.size == 0){
+                cache.recent = cache.older;
+                cache.older = {};
+            }
+            index = cache.recent.head;
+            cache.recent = {entityData[index].idInWorld, cache.recent.size - 1};
+        }
+        else{
+            SortReleased(cache);
+            index = cache.lowest.head;
+            cache.lowest = {entityData[index].idInWorld, cache.lowest.size - 1};
+        }
+        cache.n_released--;
+        return index;
+    }
+    
+    // @return the slot count - 1 links after head
+    static inline entity_t ChainAt(entity_t head, size_t count){
+        for(size_t i = 1; i < count; i++){
+            head = entityData[head].idInWorld;
+        }
+        return head;
+    }
+    
+    // merge two ascending chains into front by relinking them
+    // @return the last slot of the merged chain
+    static entity_t MergeChains(Chain& front, entity_t frontTail, Chain back, entity_t backTail){
+        if (back.size == 0){
+            return frontTail;
+        }
+        if (front.size == 0){
+            front = back;
+            return backTail;
+        }
+        // one follows the other, as when slots are released in ascending or descending order
+        if (frontTail < back.head){
+            entityData[frontTail].idInWorld = back.head;
+            front.size += back.size;
+            return backTail;
+        }
+        if (backTail < front.head){
+            entityData[backTail].idInWorld = front.head;
+            front = {back.head, front.size + back.size};
+            return frontTail;
+        }
+        const auto size = front.size + back.size;
+        entity_t head = INVALID_ENTITY, tail = INVALID_ENTITY;
+        auto link = [&](entity_t index){
+            if (tail == INVALID_ENTITY){
+                head = index;
+            }
+            else{
+                entityData[tail].idInWorld = index;
+            }
+            tail = index;
+        };
+        while(front.size > 0 && back.size > 0){
+            auto& next = front.head < back.head ? front : back;
+            const auto index = next.head;
+            next = {entityData[index].idInWorld, next.size - 1};
+            link(index);
+        }
+        // the rest of the unfinished chain is linked already
+        const bool frontLeft = front.size > 0;
+        link(frontLeft ? front.head : back.head);
+        front = {head, size};
+        return frontLeft ? frontTail : backTail;
+    }
+    
+    // sort a chain in ascending order by relinking it, with a merge sort that doesn't allocate
+    // @return the last slot of the sorted chain
+    static entity_t SortChain(Chain& chain){
+        if (chain.size <= 1){
+            return chain.head;
+        }
+        Chain front{chain.head, chain.size / 2};
+        Chain back{entityData[ChainAt(front.head, front.size)].idInWorld, chain.size - front.size};
+        const auto frontTail = SortChain(front);
+        const auto backTail = SortChain(back);
+        const auto tail = MergeChains(front, frontTail, back, backTail);
+        chain = front;
+        return tail;
+    }
+    
+    // sort the slots a thread released in LowestFirst order since it last took one into the rest
+    static inline void SortReleased(IDCache& cache){
+        if (cache.unsorted.size == 0){
+            return;
+        }
+        const auto tail = SortChain(cache.unsorted);
+        cache.lowestTail = MergeChains(cache.lowest, cache.lowestTail, cache.unsorted, tail);
+        cache.unsorted = {};
+    }
+    
+    // bring a thread's released slots into a new reuse order
+    static void ArrangeReleased(IDCache& cache, IDReuse order){
+        cache.order = order;
+        if (order == IDReuse::LowestFirst){
+            // one chain of the recent slots followed by the older ones, sorted when one is next taken
+            cache.unsorted = cache.recent;
+            if (cache.recent.size == 0){
+                cache.unsorted = cache.older;
+            }
+            else if (cache.older.size > 0){
+                entityData[ChainAt(cache.recent.head, cache.recent.size)].idInWorld = cache.older.head;
+                cache.unsorted.size += cache.older.size;
+            }
+            cache.recent = cache.older = {};
         }
         else{
-            id = entityData.size();
-            entityData.emplace_back(world,idInWorld);
+            // in ascending order, so the lowest come out first, a block at a time
+            SortReleased(cache);
+            auto rest = cache.lowest;
+            cache.lowest = {};
+            cache.lowestTail = INVALID_ENTITY;
+            for(auto chain : {&cache.recent, &cache.older}){
+                *chain = {rest.head, std::min<size_t>(rest.size, id_block_size)};
+                rest = {chain->size > 0 ? entityData[ChainAt(chain->head, chain->size)].idInWorld : INVALID_ENTITY, rest.size - chain->size};
+            }
+            if (rest.size > 0){
+                GiveShared(rest);
+                cache.n_released -= rest.size;
+            }
+        }
+    }
+    
+    // unlink the count highest of a thread's LowestFirst slots as a chain, which are the ones it would reach last
+    static inline Chain DetachLowest(IDCache& cache, size_t count){
+        SortReleased(cache);
+        if (count >= cache.lowest.size){
+            const auto chain = cache.lowest;
+            cache.lowest = {};
+            cache.lowestTail = INVALID_ENTITY;
+            cache.n_released -= chain.size;
+            return chain;
         }
-        return id;
+        const auto last = ChainAt(cache.lowest.head, cache.lowest.size - count);
+        const Chain chain{entityData[last].idInWorld, count};
+        cache.lowest.size -= count;
+        cache.lowestTail = last;
+        cache.n_released -= count;
+        return chain;
+    }
+    
+    // move a block of released slots from the shared pool into a thread's cache, which is empty
+    static inline void TakeShared(IDCache& cache){
+        Chain chain;
+        {
+            std::lock_guard<std::mutex> lk(sharedMtx);
+            if (sharedReleased.empty()){
+                return;
+            }
+            chain = sharedReleased.back();
+            sharedReleased.pop_back();
+            nShared.store(sharedReleased.size(), std::memory_order_relaxed);
+        }
+        cache.n_released = chain.size;
+        if (cache.order == IDReuse::LIFO){
+            cache.recent = chain;
+            return;
+        }
+        cache.unsorted = chain;
+    }
+    
+    // @return an unused slot index, which the caller must fill in
+    static inline entity_t TakeID(){
+        auto& cache = LocalIDs();
+        if (cache.n_released == 0 && nShared.load(std::memory_order_relaxed) > 0){
+            TakeShared(cache);
+        }
+        if (cache.n_released > 0){
+            if (cache.order != reuseOrder.load(std::memory_order_relaxed)){
+                ArrangeReleased(cache, reuseOrder.load(std::memory_order_relaxed));
+            }
+            return PopReleased(cache);
+        }
+        if (cache.fresh == cache.freshEnd){
+            cache.fresh = nextFresh.fetch_add(id_block_size, std::memory_order_relaxed);
+            cache.freshEnd = cache.fresh + id_block_size;
+        }
+        return cache.fresh++;
+    }
+    
+    static inline void GiveID(entity_t index){
+        auto& cache = LocalIDs();
+        if (cache.order != reuseOrder.load(std::memory_order_relaxed)){
+            ArrangeReleased(cache, reuseOrder.load(std::memory_order_relaxed));
+        }
+        PushReleased(cache, index);
+        if (cache.order == IDReuse::LowestFirst && cache.n_released >= 2 * id_block_size){
+            GiveShared(DetachLowest(cache, id_block_size));
+        }
+    }
+    
+    // invoked by the world
+    static inline entity_id_t CreateEntity(World* world, const entity_t idInWorld){
+        const auto index = TakeID();
+        auto& data = entityData.grow(index);
+        data.idInWorld = idInWorld;
+        data.world = world;
+        const auto generation = data.generation.load(std::memory_order_relaxed) + 1;
+        data.generation.store(generation, std::memory_order_relaxed);
+        return MakeEntityID(index, generation);
+    }
+    
+    // make room for n more entities. invoked by the world
+    static inline void Reserve(size_t n){
+        entityData.reserve(nextFresh.load(std::memory_order_relaxed) + n);
     }
     
     // invoked by the world
-    static inline void DestroyEntity(entity_t global_id){
-        auto& data = entityData[global_id];
+    static inline void DestroyEntity(entity_id_t global_id){
+        if (!IsAlive(global_id)){
+            return;     // already destroyed
+        }
+        auto& data = entityData[EntityIndex(global_id)];
         data.world->Destroy(data.idInWorld);
         
         // make this entity's ID available for reuse
@@ -48,54 +324,125 @@ class Registry{
     }
     
     template<typename T, typename ... A>
-    static inline T& EmplaceComponent(entity_t id, A ... args){
+    static inline component_ref_t<T> EmplaceComponent(entity_id_t id, A&& ... args){
+        static_assert(!std::is_same_v<T, Hierarchy>, "Use SetParent to place an entity in the hierarchy");
         // get the world
-        assert(EntityIsValid(id));
-        auto& data = entityData[id];
-        return data.world->EmplaceComponent<T>(data.idInWorld,args...);
+        assert(IsAlive(id));
+        auto& data = entityData[EntityIndex(id)];
+        return data.world->EmplaceComponent<T>(data.idInWorld, std::forward<A>(args)...);
     }
     
     template<typename T>
-    static inline void DestroyComponent(entity_t id){
-        assert(EntityIsValid(id));
-        auto& data = entityData[id];
+    static inline void DestroyComponent(entity_id_t id){
+        static_assert(!std::is_same_v<T, Hierarchy>, "Use RemoveParent to take an entity out of its parent");
+        assert(IsAlive(id));
+        auto& data = entityData[EntityIndex(id)];
         data.world->DestroyComponent<T>(data.idInWorld);
     }
     
     template<typename T>
-    static inline T& GetComponent(entity_t id) {
-        assert(EntityIsValid(id));
-        auto& data = entityData[id];
+    static inline component_ref_t<T> GetComponent(entity_id_t id) {
+        assert(IsAlive(id));
+        auto& data = entityData[EntityIndex(id)];
         return data.world->GetComponent<T>(data.idInWorld);
     }
+    
+    template<typename T>
+    static inline void MarkChanged(entity_id_t id) {
+        assert(IsAlive(id));
+        auto& data = entityData[EntityIndex(id)];
+        data.world->MarkChanged<T>(data.idInWorld);
+    }
+    
+    // @return the component, or nullptr if the entity is stale or does not have one
+    template<typename T>
+    static inline T* TryGetComponent(entity_id_t id) {
+        if (!IsAlive(id)){
+            return nullptr;
+        }
+        auto& data = entityData[EntityIndex(id)];
+        return data.world->TryGetComponent<T>(data.idInWorld);
+    }
 
     template<typename T>
-    static inline bool HasComponent(entity_t id) {
-        assert(EntityIsValid(id));
-        auto& data = entityData[id];
+    static inline bool HasComponent(entity_id_t id) {
+        assert(IsAlive(id));
+        auto& data = entityData[EntityIndex(id)];
         return data.world->HasComponent<T>(data.idInWorld);
     }
 
-    static inline World* GetWorld(entity_t id) {
-        assert(EntityIsValid(id));
-        auto& data = entityData[id];
+    static inline World* GetWorld(entity_id_t id) {
+        assert(IsAlive(id));
+        auto& data = entityData[EntityIndex(id)];
         return data.world;
     }
 
     // free an entity for reuse. this is called on world destruction
-    static inline void ReleaseEntity(entity_t global_id) {
-        assert(EntityIsValid(global_id));  // cannot destroy an invalid entity!
-        available.push(global_id);
-        auto& data = entityData[global_id];
+    static inline void ReleaseEntity(entity_id_t global_id) {
+        assert(IsAlive(global_id));  // cannot destroy an invalid entity!
+        auto& data = entityData[EntityIndex(global_id)];
+        data.generation.store(data.generation.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
         data.world = nullptr;
-        data.idInWorld = INVALID_ENTITY;
+        GiveID(EntityIndex(global_id));
+    }
+    
+    static inline entity_id_t CloneEntity(entity_id_t global_id){
+        assert(IsAlive(global_id));
+        const auto& data = entityData[EntityIndex(global_id)];
+        return data.world->CloneEntity(data.idInWorld);
     }
     
-    static inline void MoveEntityToWorld(entity_t global_id, World& newWorld){
-        assert(EntityIsValid(global_id));
+    static inline void MoveEntityToWorld(entity_id_t global_id, World& newWorld){
+        assert(IsAlive(global_id));
         
-        auto& data = entityData[global_id];
+        auto& data = entityData[EntityIndex(global_id)];
+        if (data.world == &newWorld){
+            return;
+        }
+        if (data.world->HasComponent<Hierarchy>(data.idInWorld)){
+            newWorld.AddSubtreeFrom(data.world, data.idInWorld);
+            return;
+        }
         data.idInWorld = newWorld.AddEntityFrom(data.world,data.idInWorld);
         data.world = &newWorld;
     }
+    
+    // @param parent_id the new parent, or INVALID_ENTITY_ID to make the entity a root
+    static inline void SetParent(entity_id_t global_id, entity_id_t parent_id){
+        assert(IsAlive(global_id));
+        auto& data = entityData[EntityIndex(global_id)];
+        auto parent_local_id = INVALID_ENTITY;
+        if (parent_id != INVALID_ENTITY_ID){
+            assert(IsAlive(parent_id) && entityData[EntityIndex(parent_id)].world == data.world);  // parents and children must be in the same world!
+            parent_local_id = entityData[EntityIndex(parent_id)].idInWorld;
+        }
+        data.world->SetParent(data.idInWorld, parent_local_id);
+    }
+    
+public:
+    /**
+     Choose the order in which the slots of destroyed entities are reused. The order applies to each thread's own cache of released slots,
+     which it reuses before taking a block from the shared pool, so LowestFirst hands out the lowest id that the calling thread holds,
+     not the lowest free id in the process. Other threads switch the next time they create or destroy an entity.
+     */
+    static inline void SetIDReuseOrder(IDReuse order){
+        reuseOrder.store(order, std::memory_order_relaxed);
+        if (LocalIDs().order != order){
+            ArrangeReleased(LocalIDs(), order);
+        }
+    }
+    
+    /**
+     @return true if the id refers to an entity that has not been destroyed. An id whose slot was released and reused does not match. Complexity is O(1).
+     */
+    static inline bool IsAlive(entity_id_t id){
+        const auto index = EntityIndex(id);
+        // a free slot's generation is even, and every id handed out has an odd one
+        return entityData.contains(index) && entityData[index].generation.load(std::memory_order_relaxed) == EntityGeneration(id);
+    }
 };
+
+// a global id is valid while its entity is alive
+inline bool EntityIsValid(entity_id_t id){
+    return Registry::IsAlive(id);
+}
@@ -0,0 +1,128 @@
+#pragma once
+#include "Types.hpp"
+#include <vector>
+#include <string>
+#include <string_view>
+#include <functional>
+#include <chrono>
+#include <algorithm>
+
+class World;
+
+/**
+ What a system touches, declared when it is added with World::AddSystem:
+ - Reads<T...>: the system reads these component or resource types
+ - Writes<T...>: the system writes these types, including by marking them changed
+ - Exclusive: the system changes the world's structure, such as creating or destroying entities or components,
+   and runs with no other system
+ Filter terms such as Changed<T> or Resource<T> refer to their type.
+ */
+template<typename ... T>
+struct Reads{};
+
+template<typename ... T>
+struct Writes{};
+
+struct Exclusive{};
+
+// how long one system took in the last World::Tick
+struct SystemTiming{
+    std::string_view name;
+    std::chrono::nanoseconds duration{0};
+    size_t stage = 0;   // systems in the same stage ran concurrently
+};
+
+struct TickReport{
+    std::vector<SystemTiming> systems;      // in the order the systems were added
+    std::vector<std::string_view> criticalPath;     // the chain of dependent systems with the longest total time, first to last
+    std::chrono::nanoseconds criticalPathTime{0};   // no number of threads can run a tick faster than this
+    std::chrono::nanoseconds tickTime{0};
+};
+
+/**
+ The systems of a world, and the order they run in. Systems run in the order they were added, except that
+ a system that conflicts with none of the systems before it in a stage runs concurrently with them.
+ Two systems conflict if one writes a type that the other reads or writes, or if either is Exclusive.
+ Each system waits for every earlier system it conflicts with, which makes the stages the levels of a dependency DAG.
+ */
+class Scheduler{
+    friend class World;
+
+    struct System{
+        std::string name;
+        std::function<void(World&, tick_t)> run;
+        std::vector<size_t> reads, writes;  // World::ComponentIndex of each type
+        bool exclusive = false;
+        std::vector<size_t> after;  // the earlier systems that this one conflicts with
+        size_t stage = 0;
+        tick_t lastRun = 0;         // the change tick this system last ran at
+        std::chrono::nanoseconds duration{0};
+    };
+
+    std::vector<System> systems;
+    std::vector<std::vector<size_t>> stages;
+    TickReport report;
+
+    static inline bool Overlaps(const std::vector<size_t>& a, const std::vector<size_t>& b){
+        for(auto index : a){
+            if (std::find(b.begin(), b.end(), index) != b.end()){
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static inline bool Conflicts(const System& a, const System& b){
+        return a.exclusive || b.exclusive || Overlaps(a.writes, b.reads) || Overlaps(a.writes, b.writes) || Overlaps(b.writes, a.reads);
+    }
+
+    // place a new system in the stage after the last one it conflicts with
+    inline void Add(System&& system){
+        const auto index = systems.size();
+        for(size_t i = 0; i < index; i++){
+            if (Conflicts(systems[i], system)){
+                system.after.push_back(i);
+                system.stage = std::max(system.stage, systems[i].stage + 1);
+            }
+        }
+        if (system.stage >= stages.size()){
+            stages.resize(system.stage + 1);
+        }
+        stages[system.stage].push_back(index);
+        systems.push_back(std::move(system));
+    }
+
+    // fill in the report from the durations of the tick that just ran
+    inline void Report(std::chrono::nanoseconds tickTime){
+        report.systems.clear();
+        report.criticalPath.clear();
+        report.tickTime = tickTime;
+
+        // the longest chain of durations ending at each system. Systems only wait for earlier ones, so one pass in order suffices.
+        std::vector<std::chrono::nanoseconds> chain(systems.size());
+        std::vector<size_t> previous(systems.size(), systems.size());
+        size_t last = 0;
+        for(size_t i = 0; i < systems.size(); i++){
+            for(auto dependency : systems[i].after){
+                if (chain[dependency] > chain[i]){
+                    chain[i] = chain[dependency];
+                    previous[i] = dependency;
+                }
+            }
+            chain[i] += systems[i].duration;
+            if (chain[i] > chain[last]){
+                last = i;
+            }
+            report.systems.push_back({systems[i].name, systems[i].duration, systems[i].stage});
+        }
+        if (systems.empty()){
+            report.criticalPathTime = {};
+            return;
+        }
+        report.criticalPathTime = chain[last];
+        for(auto i = last; i < systems.size(); i = previous[i]){
+            report.criticalPath.push_back(systems[i].name);
+        }
+        std::reverse(report.criticalPath.begin(), report.criticalPath.end());
+    }
+};
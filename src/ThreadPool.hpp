@@ -0,0 +1,202 @@
+#pragma once
+#include <thread>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <algorithm>
+
+/**
+ A work-stealing thread pool. Each thread owns a task queue which it works through front to back.
+ When its own queue runs dry, it steals from the back of another thread's queue, which is the work
+ that thread would have reached last. The thread that submits work also runs tasks until the work is complete.
+ */
+class ThreadPool{
+public:
+    using job_t = std::function<void(size_t, size_t)>;
+
+private:
+    struct Task{
+        const job_t* job = nullptr;
+        size_t begin = 0, end = 0;
+        std::atomic<size_t>* remaining = nullptr;
+    };
+
+    struct Queue{
+        std::mutex mtx;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;     // index 0 is shared by all threads outside of the pool
+    std::vector<std::thread> workers;
+    std::mutex sleepMtx;
+    std::condition_variable wake;
+    std::atomic<size_t> queued{0};
+    bool stop = false;
+
+    // which pool and queue the current thread belongs to
+    inline static thread_local const ThreadPool* currentPool = nullptr;
+    inline static thread_local size_t currentQueue = 0;
+
+    inline bool TryPop(size_t index, Task& task){
+        {
+            auto& own = *queues[index];
+            std::lock_guard<std::mutex> lk(own.mtx);
+            if (!own.tasks.empty()){
+                task = own.tasks.front();
+                own.tasks.pop_front();
+                queued--;
+                return true;
+            }
+        }
+        for(size_t i = 1; i < queues.size(); i++){
+            auto& victim = *queues[(index + i) % queues.size()];
+            std::lock_guard<std::mutex> lk(victim.mtx);
+            if (!victim.tasks.empty()){
+                task = victim.tasks.back();
+                victim.tasks.pop_back();
+                queued--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    inline void Run(const Task& task){
+        (*task.job)(task.begin, task.end);
+        task.remaining->fetch_sub(1, std::memory_order_release);
+    }
+
+    inline void WorkerLoop(size_t index){
+        currentPool = this;
+        currentQueue = index;
+        Task task;
+        while(true){
+            if (TryPop(index, task)){
+                Run(task);
+                continue;
+            }
+            std::unique_lock<std::mutex> lk(sleepMtx);
+            wake.wait(lk, [&]{
+                return stop || queued.load() > 0;
+            });
+            if (stop){
+                return;
+            }
+        }
+    }
+
+    inline void Start(size_t n_threads){
+        n_threads = std::max<size_t>(n_threads, 1);
+        stop = false;
+        for(size_t i = 0; i < n_threads; i++){
+            queues.push_back(std::make_unique<Queue>());
+        }
+        // queue 0 is worked by whichever thread calls ParallelFor
+        for(size_t i = 1; i < n_threads; i++){
+            workers.emplace_back([this,i]{
+                WorkerLoop(i);
+            });
+        }
+    }
+
+    inline void Shutdown(){
+        {
+            std::lock_guard<std::mutex> lk(sleepMtx);
+            stop = true;
+        }
+        wake.notify_all();
+        for(auto& worker : workers){
+            worker.join();
+        }
+        workers.clear();
+        queues.clear();
+    }
+
+public:
+
+    /**
+     @param n_threads the number of threads that run work, including the thread that submits it
+     */
+    ThreadPool(size_t n_threads = std::thread::hardware_concurrency()){
+        Start(n_threads);
+    }
+    ThreadPool(const ThreadPool&) = delete;
+
+    ~ThreadPool(){
+        Shutdown();
+    }
+
+    /**
+     Change the number of threads. Must not be called while work is running on this pool.
+     */
+    inline void SetThreadCount(size_t n_threads){
+        Shutdown();
+        Start(n_threads);
+    }
+
+    inline size_t GetThreadCount() const{
+        return queues.size();
+    }
+
+    /**
+     Split [begin, end) into ranges of at most grainSize, and invoke f(rangeBegin, rangeEnd) on each of them in parallel.
+     Returns once every range has been processed.
+     */
+    template<typename func>
+    inline void ParallelFor(size_t begin, size_t end, size_t grainSize, const func& f){
+        if (begin >= end){
+            return;
+        }
+        grainSize = std::max<size_t>(grainSize, 1);
+        const size_t n_tasks = (end - begin + grainSize - 1) / grainSize;
+        if (workers.empty() || n_tasks == 1){
+            f(begin, end);
+            return;
+        }
+
+        const job_t job = [&f](size_t b, size_t e){
+            f(b, e);
+        };
+        std::atomic<size_t> remaining{n_tasks};
+        queued += n_tasks;
+
+        // give each queue a contiguous block of tasks, so that each thread starts on its own region of memory
+        const size_t n_queues = queues.size();
+        for(size_t q = 0; q < n_queues; q++){
+            auto& queue = *queues[q];
+            std::lock_guard<std::mutex> lk(queue.mtx);
+            for(size_t t = n_tasks * q / n_queues; t < n_tasks * (q + 1) / n_queues; t++){
+                queue.tasks.push_back(Task{&job, begin + t * grainSize, std::min(end, begin + (t + 1) * grainSize), &remaining});
+            }
+        }
+        {
+            // synchronize with workers that are about to sleep, so that none of them miss the wakeup
+            std::lock_guard<std::mutex> lk(sleepMtx);
+        }
+        wake.notify_all();
+
+        // help out until all of our tasks are done
+        const size_t index = currentPool == this ? currentQueue : 0;
+        Task task;
+        while(remaining.load(std::memory_order_acquire) > 0){
+            if (TryPop(index, task)){
+                Run(task);
+            }
+            else{
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    /**
+     @return the pool used by default for parallel work
+     */
+    static inline ThreadPool& Shared(){
+        static ThreadPool pool;
+        return pool;
+    }
+};
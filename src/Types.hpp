@@ -2,16 +2,38 @@
 #include <cstdint>
 #include <limits>
 
-using entity_t = uint32_t;
+using entity_t = uint32_t;         // an index, such as a world-local id
+using generation_t = uint32_t;
+using entity_id_t = uint64_t;      // a global entity id. The low half is an index into the Registry, the high half is that slot's generation
 using pos_t = uint32_t;
+using tick_t = uint32_t;           // a world's change tick. See World::AdvanceChangeTick
 constexpr entity_t INVALID_ENTITY = std::numeric_limits<decltype(INVALID_ENTITY)>::max();
+constexpr entity_id_t INVALID_ENTITY_ID = std::numeric_limits<decltype(INVALID_ENTITY_ID)>::max();
 constexpr pos_t INVALID_INDEX = std::numeric_limits<decltype(INVALID_INDEX)>::max();
 
 static constexpr inline bool EntityIsValid(entity_t id){
     return id != INVALID_ENTITY;
 }
 
+static constexpr inline entity_id_t MakeEntityID(entity_t index, generation_t generation){
+    return (static_cast<entity_id_t>(generation) << 32) | index;
+}
+
+static constexpr inline entity_t EntityIndex(entity_id_t id){
+    return static_cast<entity_t>(id);
+}
+
+static constexpr inline generation_t EntityGeneration(entity_id_t id){
+    return static_cast<generation_t>(id >> 32);
+}
+
 static constexpr inline bool PosIsValid(pos_t id){
     return id != INVALID_INDEX;
 }
  
+
+// when a component was emplaced, and when it was last marked changed
+struct ComponentTicks{
+    tick_t added = 0;
+    tick_t changed = 0;
+};
@@ -1,14 +1,33 @@
 #pragma once
 #include "unordered_vector.hpp"
-#include <queue>
+#include "paged_sparse_array.hpp"
+#include "Archetype.hpp"
+#include "ThreadPool.hpp"
+#include "implicit_free_list.hpp"
+#include "bit_matrix.hpp"
+#include "soa_vector.hpp"
+#include "tag_vector.hpp"
+#include "FilterTerms.hpp"
+#include "Hierarchy.hpp"
+#include "Scheduler.hpp"
 #include "CTTI.hpp"
-#include <unordered_map>
+#include "resource_ptr.hpp"
+#include <vector>
+#include <string_view>
 #include <tuple>
-#include <functional>
+#include <utility>
 #include <cassert>
 #include <array>
+#include <atomic>
+#include <algorithm>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <functional>
+#include <limits>
 
 struct Entity;
+class CommandBuffer;
 
 template <typename T, typename... Ts>
 struct Index;
@@ -22,79 +41,458 @@ struct Index<T, U, Ts...> : std::integral_constant<std::size_t, 1 + Index<T, Ts.
 template <typename T, typename... Ts>
 constexpr std::size_t Index_v = Index<T, Ts...>::value;
 
+// how a World lays out its components in memory
+enum class WorldStorage : uint8_t{
+    SparseSet,  // one sparse set per component type
+    Archetype   // entities grouped by their exact component set, in chunks of columns
+};
+
+// what happened to a component, as reported to observers
+enum class ComponentEvent : uint8_t{
+    Added,      // emplaced, including onto clones
+    Removed,    // destroyed, on its own or with its entity
+    MovedIn,    // arrived with its entity from another world
+    MovedOut,   // left with its entity for another world
+    Count
+};
+
 class World{
     
-    std::vector<entity_t> localToGlobal;
-    std::queue<entity_t> available;
+    std::pmr::memory_resource* const resource;  // every array this world owns allocates from here
+    std::pmr::vector<entity_id_t> localToGlobal;
+    
+    // a free local slot has no global index, and keeps the next free slot where the generation would be
+    struct FreeSlotTraits{
+        static inline bool is_free(entity_id_t id){
+            return !EntityIsValid(EntityIndex(id));
+        }
+        static inline entity_t next(entity_id_t id){
+            return EntityGeneration(id);
+        }
+        static inline void set_free(entity_id_t& id, entity_t next){
+            id = MakeEntityID(INVALID_ENTITY, next);
+        }
+    };
+    implicit_free_list<FreeSlotTraits> available;
+    const WorldStorage storageMode;
+    tick_t changeTick = 1;  // components emplaced or marked changed now are stamped with this
+    ArchetypeStorage archetypes;
     
     friend class Entity;
     friend class Registry;
+    friend class CommandBuffer;
     
-    template<typename T>
-    class SparseSet{
-        unordered_vector<T> dense_set;
-        unordered_vector<entity_t> aux_set;
-        std::vector<entity_t> sparse_set;
+    struct OwningGroup;
+    struct DepthOrder;
+    class SparseSetBase;
+    
+    /**
+     The operations on a SparseSet that don't depend on its component type at the call site.
+     Each component type has one static table, shared by every set and every world.
+     */
+    struct SparseSetVTable{
+        void(*destroy)(SparseSetBase* set, entity_t local_id);     // destroy the entity's component, if it has one
+        void(*dealloc)(SparseSetBase* set);
+        void(*moveToWorld)(SparseSetBase* set, entity_t local_id, World* dest, entity_t dest_local_id);
+        void(*copyToWorld)(SparseSetBase* set, entity_t local_id, World* dest, entity_t dest_local_id);
+        void(*swapDense)(SparseSetBase* set, pos_t a, pos_t b);
+        void(*reserveDense)(SparseSetBase* set, size_t n_more);
+        void(*clear)(SparseSetBase* set);
+        size_t(*size)(const SparseSetBase* set);
+    };
+    
+    // the entity bookkeeping of a SparseSet, which does not depend on the component type
+    class SparseSetBase{
+    protected:
+        unordered_vector<entity_t, std::pmr::vector<entity_t>> aux_set;
+        paged_sparse_array<entity_t, INVALID_ENTITY> sparse_set;
+        OwningGroup* group = nullptr;
+        DepthOrder* depthOrder = nullptr;   // only for the Hierarchy set
+        const SparseSetVTable* vtable = nullptr;
+        bit_matrix* signatures = nullptr;   // the world's component signatures, where this set owns one column
+        size_t signatureBit = 0;
+        std::pmr::vector<ComponentTicks> ticks; // parallel to the dense array, and empty for tags, which have no ticks
+        bool hasTicks = true;
+        const tick_t* currentTick = nullptr;    // the world's change tick
         
-    public:
+        friend struct OwningGroup;
+        friend struct DepthOrder;
+        friend class World;
         
-        template<typename ... A>
-        inline T& Emplace(entity_t local_id, A ... args){
-            dense_set.emplace(args...);
+        SparseSetBase(std::pmr::memory_resource* resource) : aux_set(resource), sparse_set(resource), ticks(resource){}
+        
+        inline void EmplaceOwner(entity_t local_id, pos_t pos){
             aux_set.emplace(local_id);
-            sparse_set.resize(local_id+1,INVALID_ENTITY);  //ensure there is enough space for this id
-            
-            sparse_set[local_id] = dense_set.size()-1;
-            return dense_set[dense_set.size()-1];
+            sparse_set.insert(local_id, pos);   // allocates the page for this id if needed
+            signatures->set(local_id, signatureBit);
+            if (hasTicks){
+                ticks.push_back({*currentTick, *currentTick});
+            }
         }
         
-        inline void Destroy(entity_t local_id){
-            assert(local_id < sparse_set.size());
-            assert(HasComponent(local_id)); // Cannot destroy a component on an entity that does not have one!
-            // call the destructor
-            dense_set.erase(dense_set.begin() + sparse_set[local_id]);
-            aux_set.erase(aux_set.begin() + sparse_set[local_id]);
-
-            if (!aux_set.empty()) {
-                // update the location it points
-                auto owner = aux_set[sparse_set[local_id]];
-                sparse_set[owner] = local_id;
-                
+        // the entry at pos is being removed by moving the last entry into it
+        inline void EraseTicks(pos_t pos){
+            if (hasTicks){
+                ticks[pos] = ticks.back();
+                ticks.pop_back();
             }
-            sparse_set[local_id] = INVALID_INDEX;
         }
-
-        inline T& GetComponent(entity_t local_id){
-            return dense_set[sparse_set[local_id]];
+        
+        // swap two entries in the dense order, keeping the sparse set pointing at them
+        inline void SwapEntries(pos_t a, pos_t b){
+            if (a == b){
+                return;
+            }
+            SwapBookkeeping(a, b);
+            vtable->swapDense(this, a, b);
         }
         
+        // swap everything about two entries except the components
+        inline void SwapBookkeeping(pos_t a, pos_t b){
+            std::swap(aux_set[a], aux_set[b]);
+            sparse_set[aux_set[a]] = a;
+            sparse_set[aux_set[b]] = b;
+            if (hasTicks){
+                std::swap(ticks[a], ticks[b]);
+            }
+        }
+        
+    public:
         inline bool HasComponent(entity_t local_id) const{
-            return sparse_set[local_id] != INVALID_ENTITY;
+            return sparse_set.contains(local_id);
         }
         
-        auto begin(){
-            return dense_set.begin();
+        /**
+         Make room for more components
+         @param n_more the number of components that will be added
+         @param max_local_id the highest local id that will be added
+         */
+        inline void Reserve(size_t n_more, entity_t max_local_id){
+            aux_set.reserve(aux_set.size() + n_more);
+            if (hasTicks){
+                ticks.reserve(ticks.size() + n_more);
+            }
+            sparse_set.reserve(max_local_id + 1);
+            vtable->reserveDense(this, n_more);
         }
         
-        auto end(){
-            return dense_set.end();
+        // @return the dense index of the entity's component
+        inline pos_t IndexOf(entity_t local_id) const{
+            return sparse_set[local_id];
         }
         
-        auto begin() const{
-            return dense_set.begin();
+        inline entity_t GetOwner(entity_t idx) const{
+            return aux_set[idx];
         }
         
-        auto end() const{
-            return dense_set.end();
+        // get the ticks by dense index
+        inline ComponentTicks& TicksAt(entity_t idx){
+            return ticks[idx];
         }
         
-        // get by dense index, not by entity ID
-        T& Get(entity_t idx){
-            return dense_set[idx];
+        inline void MarkChanged(entity_t local_id){
+            ticks[sparse_set[local_id]].changed = *currentTick;
         }
         
-        auto GetOwner(entity_t idx) const{
-            return aux_set[idx];
+        inline OwningGroup* GetGroup() const{
+            return group;
+        }
+    };
+    
+    /**
+     An owning group keeps the entities that have all of its component types at the front of each of its sets,
+     in the same order in every set. Iterating the group is then a plain indexed loop over the shared prefix.
+     */
+    struct OwningGroup{
+        std::pmr::vector<SparseSetBase*> sets;
+        size_t size = 0;    // length of the grouped prefix
+        
+        OwningGroup(std::pmr::memory_resource* resource) : sets(resource){}
+        
+        // an entity gained a component in one of the sets
+        inline void OnEmplace(entity_t local_id){
+            for(auto set : sets){
+                if (!set->HasComponent(local_id)){
+                    return;
+                }
+            }
+            for(auto set : sets){
+                set->SwapEntries(set->IndexOf(local_id), static_cast<pos_t>(size));
+            }
+            size++;
+        }
+        
+        // an entity is about to lose a component in one of the sets
+        inline void OnDestroy(entity_t local_id, const SparseSetBase* from){
+            if (from->IndexOf(local_id) >= size){
+                return;
+            }
+            size--;
+            for(auto set : sets){
+                set->SwapEntries(set->IndexOf(local_id), static_cast<pos_t>(size));
+            }
+        }
+    };
+    
+    /**
+     Keeps the dense order of the Hierarchy set sorted by depth, so that every parent comes before its children.
+     Each depth is a bucket. An entry changes buckets by swapping places with the first or last entry of each bucket in between,
+     so inserting, removing or re-parenting costs a swap per level, not a sort.
+     */
+    struct DepthOrder{
+        std::pmr::vector<pos_t> ends;   // one past the last entry at each depth
+        
+        DepthOrder(std::pmr::memory_resource* resource) : ends(resource){}
+        
+        // the last entry of the set is new, or was just removed from its bucket. Move it into the bucket for depth.
+        inline void Insert(SparseSetBase* set, uint32_t depth){
+            auto pos = static_cast<pos_t>(set->aux_set.size() - 1);
+            if (depth >= ends.size()){
+                ends.resize(depth + 1, pos);
+            }
+            for(size_t k = ends.size() - 1; k > depth; k--){
+                set->SwapEntries(pos, ends[k - 1]);
+                pos = ends[k - 1];
+                ends[k]++;
+            }
+            ends[depth]++;
+        }
+        
+        // move the entry at pos out of its bucket, to the end of the set
+        inline void Remove(SparseSetBase* set, pos_t pos){
+            const auto depth = static_cast<size_t>(std::upper_bound(ends.begin(), ends.end(), pos) - ends.begin());
+            for(size_t k = depth; k < ends.size(); k++){
+                ends[k]--;
+                set->SwapEntries(pos, ends[k]);
+                pos = ends[k];
+            }
+            while(!ends.empty() && ends.back() == (ends.size() > 1 ? ends[ends.size() - 2] : 0)){
+                ends.pop_back();
+            }
+        }
+    };
+    
+    // deferred, so that soa_vector is only named for types that have an SoALayout
+    template<typename T>
+    struct aos_dense{
+        using type = unordered_vector<T, std::pmr::vector<T>>;
+    };
+    template<typename T>
+    struct soa_dense{
+        using type = soa_vector<T>;
+    };
+    template<typename T>
+    struct tag_dense{
+        using type = tag_vector<T>;
+    };
+    template<typename T>
+    constexpr static bool erases_at = is_soa_v<T> || std::is_empty_v<T>;
+    
+    template<typename T>
+    class SparseSet : public SparseSetBase{
+        // components with an SoALayout keep each field in its own column, and empty components are only membership in aux_set
+        typename std::conditional_t<std::is_empty_v<T>, tag_dense<T>, std::conditional_t<is_soa_v<T>, soa_dense<T>, aos_dense<T>>>::type dense_set;
+        
+        static void DestroyIfPresent(SparseSetBase* base, entity_t local_id){
+            auto self = static_cast<SparseSet<T>*>(base);
+            if (self->HasComponent(local_id)){
+                self->Destroy(local_id);
+            }
+        }
+        
+        static void Dealloc(SparseSetBase* base){
+            auto self = static_cast<SparseSet<T>*>(base);
+            std::pmr::polymorphic_allocator<SparseSet<T>> alloc(self->aux_set.get_allocator());
+            self->~SparseSet<T>();
+            alloc.deallocate(self, 1);
+        }
+        
+        static void MoveToWorld(SparseSetBase* base, entity_t local_id, World* dest, entity_t dest_local_id){
+            auto self = static_cast<SparseSet<T>*>(base);
+            if (self->HasComponent(local_id)){
+                dest->StoreComponent<T>(dest_local_id, std::move(self->GetComponent(local_id)));
+                self->Destroy(local_id);
+            }
+        }
+        
+        static void CopyToWorld(SparseSetBase* base, entity_t local_id, World* dest, entity_t dest_local_id){
+            auto self = static_cast<SparseSet<T>*>(base);
+            if (!self->HasComponent(local_id)){
+                return;
+            }
+            if constexpr (std::is_same_v<T, Hierarchy>){
+                return;     // a clone starts outside of the hierarchy
+            }
+            else{
+                // copy first, the emplace may grow this set and move the original
+                T copy(self->GetComponent(local_id));
+                dest->EmplaceComponent<T>(dest_local_id, std::move(copy));
+            }
+        }
+        
+        static void SwapDense(SparseSetBase* base, pos_t a, pos_t b){
+            auto self = static_cast<SparseSet<T>*>(base);
+            if constexpr (erases_at<T>){
+                self->dense_set.swap_elements(a, b);
+            }
+            else{
+                std::swap(self->dense_set[a], self->dense_set[b]);
+            }
+        }
+        
+        static void ReserveDense(SparseSetBase* base, size_t n_more){
+            auto self = static_cast<SparseSet<T>*>(base);
+            self->dense_set.reserve(self->dense_set.size() + n_more);
+        }
+        
+        static void Clear(SparseSetBase* base){
+            auto self = static_cast<SparseSet<T>*>(base);
+            for(auto owner : self->aux_set){
+                self->signatures->reset(owner, self->signatureBit);
+            }
+            self->dense_set.clear();
+            self->aux_set.clear();
+            self->ticks.clear();
+            self->sparse_set.clear();
+            if (self->group != nullptr){
+                self->group->size = 0;
+            }
+            if (self->depthOrder != nullptr){
+                self->depthOrder->ends.clear();
+            }
+        }
+        
+        static size_t Size(const SparseSetBase* base){
+            return static_cast<const SparseSet<T>*>(base)->DenseSize();
+        }
+        
+        static const SparseSetVTable* VTable(){
+            static constexpr SparseSetVTable table{
+                &DestroyIfPresent,
+                &Dealloc,
+                &MoveToWorld,
+                std::is_copy_constructible_v<T> ? &CopyToWorld : nullptr,
+                &SwapDense,
+                &ReserveDense,
+                &Clear,
+                &Size
+            };
+            return &table;
+        }
+        
+    public:
+        SparseSet(std::pmr::memory_resource* resource) : SparseSetBase(resource), dense_set(resource){
+            vtable = VTable();
+            hasTicks = !std::is_empty_v<T>;
+        }
+        
+        template<typename ... A>
+        inline component_ref_t<T> Emplace(entity_t local_id, A&& ... args){
+            dense_set.emplace(std::forward<A>(args)...);
+            EmplaceOwner(local_id, dense_set.size()-1);
+            if (group != nullptr){
+                group->OnEmplace(local_id);
+            }
+            if constexpr (std::is_same_v<T, Hierarchy>){
+                if (depthOrder != nullptr){
+                    depthOrder->Insert(this, dense_set[dense_set.size() - 1].depth);
+                }
+            }
+            return dense_set[sparse_set[local_id]];
+        }
+        
+        // like SwapEntries, without going through the vtable
+        inline void SwapTyped(pos_t a, pos_t b){
+            if (a != b){
+                SwapBookkeeping(a, b);
+                SwapDense(this, a, b);
+            }
+        }
+        
+        /**
+         Reorder the dense entries by cmp, following the cycles of a sorted permutation so that each entry moves once.
+         @param scratch where the permutation is allocated
+         */
+        template<typename Compare>
+        inline void Sort(const Compare& cmp, std::pmr::memory_resource* scratch){
+            assert(group == nullptr);   // sorting would break the group's packed order!
+            assert(depthOrder == nullptr);  // sorting would break the depth order!
+            std::pmr::vector<pos_t> perm(DenseSize(), scratch);
+            for(pos_t i = 0; i < perm.size(); i++){
+                perm[i] = i;
+            }
+            std::sort(perm.begin(), perm.end(), [&](pos_t a, pos_t b){
+                return cmp(dense_set[a], dense_set[b]);
+            });
+            // position j takes the entry that was at perm[j]
+            for(pos_t i = 0; i < perm.size(); i++){
+                auto j = i;
+                while(perm[j] != i){
+                    const auto k = perm[j];
+                    SwapTyped(j, k);
+                    perm[j] = j;
+                    j = k;
+                }
+                perm[j] = j;
+            }
+        }
+        
+        // move the entities that are also in other to the front, in other's order
+        inline void SortAs(const SparseSetBase& other){
+            assert(group == nullptr);   // sorting would break the group's packed order!
+            assert(depthOrder == nullptr);  // sorting would break the depth order!
+            pos_t pos = 0;
+            for(size_t i = 0; i < other.aux_set.size(); i++){
+                const auto owner = other.aux_set[i];
+                if (HasComponent(owner)){
+                    SwapTyped(IndexOf(owner), pos++);
+                }
+            }
+        }
+        
+        inline void Destroy(entity_t local_id){
+            assert(HasComponent(local_id)); // Cannot destroy a component on an entity that does not have one!
+            if (group != nullptr){
+                // move it out of the grouped prefix first, so the swap-remove below only reorders the ungrouped tail
+                group->OnDestroy(local_id, this);
+            }
+            if (depthOrder != nullptr){
+                depthOrder->Remove(this, sparse_set[local_id]);
+            }
+            // call the destructor
+            const auto pos = sparse_set[local_id];
+            if constexpr (erases_at<T>){
+                dense_set.erase_at(pos);
+            }
+            else{
+                dense_set.erase(dense_set.begin() + pos);
+            }
+            aux_set.erase(aux_set.begin() + pos);
+            EraseTicks(pos);
+
+            if (pos < aux_set.size()) {
+                // the last element was moved into this slot, update the location it points
+                auto owner = aux_set[pos];
+                sparse_set[owner] = pos;
+                
+            }
+            sparse_set.erase(local_id);
+            signatures->reset(local_id, signatureBit);
+        }
+
+        inline component_ref_t<T> GetComponent(entity_t local_id){
+            return dense_set[sparse_set[local_id]];
+        }
+        
+        inline T* TryGetComponent(entity_t local_id){
+            static_assert(!is_soa_v<T>, "SoA components cannot be referred to by pointer. Use HasComponent and GetComponent.");
+            const auto pos = sparse_set.get(local_id);
+            return pos != INVALID_ENTITY ? &dense_set[pos] : nullptr;
+        }
+        
+        // get by dense index, not by entity ID
+        component_ref_t<T> Get(entity_t idx){
+            return dense_set[idx];
         }
         
         auto DenseSize() const{
@@ -102,184 +500,1286 @@ class World{
         }
     };
     
+    // owns a SparseSet of any component type. Its type-dependent operations are reached through the set's vtable.
     struct SparseSetErased{
-        constexpr static size_t buf_size = sizeof(SparseSet<size_t>);   // we use size_t here because all SparseSets are the same size 
-        std::array<char, buf_size> buffer;
-        std::function<void(entity_t id)> destroyFn;
-        std::function<void(void)> deallocFn;
-        std::function<void(entity_t, entity_t, World*)> moveFn;
+        SparseSetBase* set = nullptr;   // allocated from the world's memory resource
         
         template<typename T>
         inline SparseSet<T>* GetSet() {
-            return reinterpret_cast<SparseSet<T>*>(buffer.data());
+            return static_cast<SparseSet<T>*>(set);
         }
         
-        // the discard parameter is here to make the template work
+        inline SparseSetBase* GetBase(){
+            return set;
+        }
+        
+        inline const SparseSetVTable& Ops(){
+            return *set->vtable;
+        }
+        
+        explicit inline operator bool() const{
+            return set != nullptr;
+        }
+        
+        SparseSetErased() = default;
+        
+        // the unused pointer parameter is here to make the template work, because a constructor's template arguments can only be deduced
         template<typename T>
-        SparseSetErased(T* discard) :
-            destroyFn([&](entity_t local_id){
-                auto ptr = GetSet<T>();
-                if (ptr->HasComponent(local_id)){
-                    ptr->Destroy(local_id);
-                }
-            }),
-            deallocFn([&]() {
-                GetSet<T>()->~SparseSet<T>();
-            }),
-            moveFn([&](entity_t localID, entity_t otherLocalID, World* otherWorld){
-                auto sp = GetSet<T>();
-                if (sp->HasComponent(localID)){
-                    auto& comp = sp->GetComponent(localID);
-                    otherWorld->EmplaceComponent<T>(otherLocalID, std::move(comp));
-                    // then delete it from here
-                    sp->Destroy(localID);
-                }
-            })
-        {
-            static_assert(sizeof(SparseSet<T>) <= buf_size);
-            new (buffer.data()) SparseSet<T>();
+        SparseSetErased(T*, std::pmr::memory_resource* resource){
+            std::pmr::polymorphic_allocator<SparseSet<T>> alloc(resource);
+            set = new (alloc.allocate(1)) SparseSet<T>(resource);
+        }
+        SparseSetErased(const SparseSetErased&) = delete;
+        SparseSetErased(SparseSetErased&& other) noexcept : set(other.set){
+            other.set = nullptr;
+        }
+        SparseSetErased& operator=(SparseSetErased&& other) noexcept{
+            std::swap(set, other.set);
+            return *this;
         }
 
         ~SparseSetErased() {
-            deallocFn();
+            if (set != nullptr){
+                Ops().dealloc(set);
+            }
         }
     };
     
-    std::unordered_map<RavEngine::ctti_t, SparseSetErased> componentMap;
+    // indexed by ComponentIndex. Empty for types that have not been used in this world.
+    std::pmr::vector<SparseSetErased> componentSets;
+    
+    // one row per local id, with the bit at each ComponentIndex set if the entity has that component
+    bit_matrix signatures;
+    
+    // the depth order of this world's Hierarchy set, in sparse-set storage
+    DepthOrder hierarchyOrder;
+    
+    // assign the next component index. Aborts if the type's hash collides with another type's, even one with the same name.
+    static size_t RegisterComponentType(RavEngine::ctti_t id, std::string_view name);
+    
+    /**
+     @return a small sequential index for T, shared by every world. Each type gets its index the first time it is used.
+     */
+    template<typename T>
+    static inline size_t ComponentIndex(){
+        static const size_t index = RegisterComponentType(RavEngine::CTTI<T>(), RavEngine::type_name<T>());
+        return index;
+    }
+
+    template<typename T>
+    static void MoveComponentToWorld(void* src, World* dest, entity_t dest_local_id){
+        dest->StoreComponent<T>(dest_local_id, std::move(*static_cast<T*>(src)));
+    }
+    
+    template<typename T>
+    static void CopyComponentToWorld(const void* src, World* dest, entity_t dest_local_id){
+        if constexpr (std::is_same_v<T, Hierarchy>){
+            return;     // a clone starts outside of the hierarchy
+        }
+        else{
+            T copy(*static_cast<const T*>(src));
+            dest->EmplaceComponent<T>(dest_local_id, std::move(copy));
+        }
+    }
+    
+    template<typename T>
+    friend const ComponentTypeInfo& GetComponentTypeInfo();
 
-    inline void Destroy(entity_t local_id){
-        // go down the list of all component types registered in this world
-        // and call destroy if the entity has that component type
-        // possible optimization: vector of vector<ctti_t> to make this faster?
-        for(const auto& pair : componentMap){
-            pair.second.destroyFn(local_id);
+    // destroy an entity, and its whole subtree if it is in the hierarchy
+    void Destroy(entity_t local_id);
+    
+    inline void DestroyOne(entity_t local_id){
+        RecordEventOnAll(ComponentEvent::Removed, local_id);
+        if (storageMode == WorldStorage::Archetype){
+            archetypes.DestroyEntity(local_id);
+            available.push(localToGlobal, local_id);
+            return;
         }
-        // unset localToGlobal
-        localToGlobal[local_id] = INVALID_ENTITY;
+        // only visit the sets this entity has a component in
+        EnumerateComponentsOn(local_id, [&](SparseSetErased& sp_erased){
+            sp_erased.Ops().destroy(sp_erased.GetBase(), local_id);
+        });
+        // unset localToGlobal, and make the local id available for reuse
+        available.push(localToGlobal, local_id);
     }
     
     template<typename T>
     inline SparseSet<T>* MakeIfNotExists(){
-        auto id = RavEngine::CTTI<T>();
-        auto it = componentMap.find(id);
-        if (it == componentMap.end()){
-            T* discard; // to make the template work
-            it = componentMap.emplace(std::make_pair(id,discard)).first;
+        const auto index = ComponentIndex<T>();
+        if (index >= componentSets.size()){
+            componentSets.resize(index + 1);
         }
-        auto ptr = (*it).second.template GetSet<T>();
-        assert(ptr != nullptr);
-        return ptr;
+        auto& sp_erased = componentSets[index];
+        if (!sp_erased){
+            T* discard = nullptr; // to make the template work
+            sp_erased = SparseSetErased(discard, resource);
+            auto base = sp_erased.GetBase();
+            base->signatures = &signatures;
+            base->signatureBit = index;
+            base->currentTick = &changeTick;
+            if constexpr (std::is_same_v<T, Hierarchy>){
+                base->depthOrder = &hierarchyOrder;
+            }
+        }
+        return sp_erased.template GetSet<T>();
     }
     
+    // the events of one component type, recorded in order until they are delivered
+    struct TypeObservers{
+        using list_t = std::pmr::vector<std::function<void(const entity_id_t*, size_t)>>;
+        std::array<list_t, size_t(ComponentEvent::Count)> observers;
+        std::pmr::vector<entity_id_t> ids;
+        std::pmr::vector<ComponentEvent> events;    // parallel to ids
+        
+        TypeObservers(std::pmr::memory_resource* resource) : observers(MakeLists(resource, std::make_index_sequence<size_t(ComponentEvent::Count)>{})), ids(resource), events(resource){}
+        
+    private:
+        template<size_t ... I>
+        static inline std::array<list_t, sizeof ... (I)> MakeLists(std::pmr::memory_resource* resource, std::index_sequence<I...>){
+            return {((void)I, list_t(resource))...};
+        }
+    };
+    
+    // owns one resource, allocated from the world's memory resource
+    struct ResourceSlot{
+        void* data = nullptr;
+        void(*dealloc)(void* data, std::pmr::memory_resource* resource) = nullptr;
+        std::pmr::memory_resource* resource = nullptr;
+        
+        ResourceSlot() = default;
+        ResourceSlot(const ResourceSlot&) = delete;
+        ResourceSlot(ResourceSlot&& other) noexcept : data(other.data), dealloc(other.dealloc), resource(other.resource){
+            other.data = nullptr;
+        }
+        ResourceSlot& operator=(ResourceSlot&& other) noexcept{
+            std::swap(data, other.data);
+            std::swap(dealloc, other.dealloc);
+            std::swap(resource, other.resource);
+            return *this;
+        }
+        ~ResourceSlot(){
+            if (data != nullptr){
+                dealloc(data, resource);
+            }
+        }
+    };
+    
+    // indexed by ComponentIndex, which numbers resource types along with component types
+    std::pmr::vector<ResourceSlot> resources;
+    
+    Scheduler scheduler;
+    
+    template<typename ... T>
+    static inline void AddAccess(Reads<T...>, Scheduler::System& system){
+        (system.reads.push_back(ComponentIndex<term_component_t<T>>()), ...);
+    }
+    
+    template<typename ... T>
+    static inline void AddAccess(Writes<T...>, Scheduler::System& system){
+        (system.writes.push_back(ComponentIndex<term_component_t<T>>()), ...);
+    }
+    
+    static inline void AddAccess(Exclusive, Scheduler::System& system){
+        system.exclusive = true;
+    }
+    
+    // indexed by ComponentIndex. Null for types that nobody observes in this world.
+    std::pmr::vector<resource_ptr<TypeObservers>> observers;
+    
+    inline void RecordEvent(size_t index, ComponentEvent event, entity_t local_id){
+        if (index < observers.size() && observers[index] && !observers[index]->observers[size_t(event)].empty()){
+            observers[index]->ids.push_back(localToGlobal[local_id]);
+            observers[index]->events.push_back(event);
+        }
+    }
+    
+    // record an event for every component on an entity
+    inline void RecordEventOnAll(ComponentEvent event, entity_t local_id){
+        if (observers.empty()){
+            return;
+        }
+        if (storageMode == WorldStorage::Archetype){
+            archetypes.EnumerateTypesOn(local_id, [&](const ComponentTypeInfo& info){
+                RecordEvent(info.index(), event, local_id);
+            });
+        }
+        else{
+            EnumerateComponentsOn(local_id, [&](SparseSetErased& sp_erased){
+                RecordEvent(sp_erased.GetBase()->signatureBit, event, local_id);
+            });
+        }
+    }
+    
+    // put a component in storage without telling observers, for components that are moving in from another world
     template<typename T, typename ... A>
-    inline T& EmplaceComponent(entity_t local_id, A ... args){
+    inline component_ref_t<T> StoreComponent(entity_t local_id, A&& ... args){
+        if (storageMode == WorldStorage::Archetype){
+            return component_ref_t<T>(archetypes.Emplace<T>(local_id, std::forward<A>(args)...));
+        }
         auto ptr = MakeIfNotExists<T>();
         
         //TODO: detect if T constructor's first argument is an entity_t, if it is, then we need to pass that before args (pass local_id again)
-        return ptr->Emplace(local_id,args...);
+        return ptr->Emplace(local_id, std::forward<A>(args)...);
+    }
+    
+    template<typename T, typename ... A>
+    inline component_ref_t<T> EmplaceComponent(entity_t local_id, A&& ... args){
+        RecordEvent(ComponentIndex<T>(), ComponentEvent::Added, local_id);
+        return StoreComponent<T>(local_id, std::forward<A>(args)...);
+    }
+    
+    // hierarchy links are global ids. Linked entities are always in the same world.
+    inline Hierarchy& HierarchyOf(entity_id_t global_id){
+        return GetComponent<Hierarchy>(LocalIDOf(global_id));
+    }
+    
+    // take an entity out of its parent's list of children, leaving its own subtree attached
+    inline void Unlink(entity_t local_id){
+        const auto global_id = localToGlobal[local_id];
+        auto& h = GetComponent<Hierarchy>(local_id);
+        if (h.parent == INVALID_ENTITY_ID){
+            return;
+        }
+        auto& parent = HierarchyOf(h.parent);
+        if (parent.firstChild == global_id){
+            parent.firstChild = h.nextSibling;
+        }
+        else{
+            auto prev = parent.firstChild;
+            while(HierarchyOf(prev).nextSibling != global_id){
+                prev = HierarchyOf(prev).nextSibling;
+            }
+            HierarchyOf(prev).nextSibling = h.nextSibling;
+        }
+        h.parent = INVALID_ENTITY_ID;
+        h.nextSibling = INVALID_ENTITY_ID;
+    }
+    
+    // append the global ids of an entity and all of its descendants, each after its parent
+    inline void CollectSubtree(entity_t local_id, std::pmr::vector<entity_id_t>& subtree){
+        const auto begin = subtree.size();
+        subtree.push_back(localToGlobal[local_id]);
+        for(auto i = begin; i < subtree.size(); i++){
+            for(auto child = HierarchyOf(subtree[i]).firstChild; child != INVALID_ENTITY_ID; child = HierarchyOf(child).nextSibling){
+                subtree.push_back(child);
+            }
+        }
+    }
+    
+    // give an entity a new depth, and its descendants the depths below it
+    inline void SetSubtreeDepth(entity_t local_id, uint32_t depth){
+        std::pmr::vector<std::pair<entity_id_t, uint32_t>> pending(resource);
+        pending.emplace_back(localToGlobal[local_id], depth);
+        auto set = storageMode == WorldStorage::SparseSet ? MakeIfNotExists<Hierarchy>() : nullptr;
+        while(!pending.empty()){
+            const auto [id, d] = pending.back();
+            pending.pop_back();
+            auto& h = HierarchyOf(id);
+            if (h.depth == d){
+                continue;   // every descendant is already at the right depth too
+            }
+            h.depth = d;
+            for(auto child = h.firstChild; child != INVALID_ENTITY_ID; child = HierarchyOf(child).nextSibling){
+                pending.emplace_back(child, d + 1);
+            }
+            if (set != nullptr){
+                // this moves h
+                hierarchyOrder.Remove(set, set->IndexOf(LocalIDOf(id)));
+                hierarchyOrder.Insert(set, d);
+            }
+        }
+    }
+    
+    // @return true if ancestor is local_id or one of its ancestors
+    inline bool IsAncestorOf(entity_t ancestor, entity_t local_id){
+        const auto ancestor_id = localToGlobal[ancestor];
+        for(auto id = localToGlobal[local_id]; id != INVALID_ENTITY_ID; id = HierarchyOf(id).parent){
+            if (id == ancestor_id){
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    // @param parent_local_id the new parent, or INVALID_ENTITY to make the entity a root
+    inline void SetParent(entity_t local_id, entity_t parent_local_id){
+        if (!HasComponent<Hierarchy>(local_id)){
+            EmplaceComponent<Hierarchy>(local_id);
+        }
+        uint32_t depth = 0;
+        if (EntityIsValid(parent_local_id)){
+            if (!HasComponent<Hierarchy>(parent_local_id)){
+                EmplaceComponent<Hierarchy>(parent_local_id);
+            }
+            assert(!IsAncestorOf(local_id, parent_local_id));   // an entity cannot be its own ancestor!
+            Unlink(local_id);
+            auto& parent = GetComponent<Hierarchy>(parent_local_id);
+            auto& child = GetComponent<Hierarchy>(local_id);
+            child.parent = localToGlobal[parent_local_id];
+            child.nextSibling = parent.firstChild;
+            parent.firstChild = localToGlobal[local_id];
+            depth = parent.depth + 1;
+        }
+        else{
+            Unlink(local_id);
+        }
+        SetSubtreeDepth(local_id, depth);
+    }
+
+    template<typename T>
+    inline component_ref_t<T> GetComponent(entity_t local_id) {
+        if (storageMode == WorldStorage::Archetype){
+            return component_ref_t<T>(archetypes.Get<T>(local_id));
+        }
+        auto set = static_cast<SparseSet<T>*>(FilterGetSparseSet<T>());
+        assert(set != nullptr);    // no entity in this world has this component type!
+        return set->GetComponent(local_id);
     }
 
+    // one lookup instead of HasComponent followed by GetComponent
     template<typename T>
-    inline T& GetComponent(entity_t local_id) {
-        return componentMap.at(RavEngine::CTTI<T>()).template GetSet<T>()->GetComponent(local_id);
+    inline T* TryGetComponent(entity_t local_id) {
+        static_assert(!is_soa_v<T>, "SoA components cannot be referred to by pointer. Use HasComponent and GetComponent.");
+        if (storageMode == WorldStorage::Archetype){
+            return archetypes.Has<T>(local_id) ? &archetypes.Get<T>(local_id) : nullptr;
+        }
+        auto set = static_cast<SparseSet<T>*>(FilterGetSparseSet<T>());
+        return set != nullptr ? set->TryGetComponent(local_id) : nullptr;
     }
 
     template<typename T>
     inline bool HasComponent(entity_t local_id) {
-        return componentMap.at(RavEngine::CTTI<T>()).template GetSet<T>()->HasComponent(local_id);
+        if (storageMode == WorldStorage::Archetype){
+            return archetypes.Has<T>(local_id);
+        }
+        auto set = static_cast<SparseSet<T>*>(FilterGetSparseSet<T>());
+        return set != nullptr && set->HasComponent(local_id);
     }
     
     template<typename T>
-    inline void DestroyComponent(entity_t local_id){
-        componentMap.at(RavEngine::CTTI<T>()).template GetSet<T>()->Destroy(local_id);
+    inline void MarkChanged(entity_t local_id){
+        static_assert(!std::is_empty_v<T>, "Tags have no change ticks");
+        if (storageMode == WorldStorage::Archetype){
+            archetypes.GetTicks<T>(local_id).changed = changeTick;
+            return;
+        }
+        auto set = static_cast<SparseSet<T>*>(FilterGetSparseSet<T>());
+        assert(set != nullptr && set->HasComponent(local_id));    // the entity does not have this component!
+        set->MarkChanged(local_id);
     }
     
     template<typename T>
-    inline SparseSet<T>* GetRange(){
-        auto& set = componentMap.at(RavEngine::CTTI<T>());
-        return set.template GetSet<T>();
+    inline void DestroyComponent(entity_t local_id){
+        RecordEvent(ComponentIndex<T>(), ComponentEvent::Removed, local_id);
+        if (storageMode == WorldStorage::Archetype){
+            archetypes.Destroy<T>(local_id);
+            return;
+        }
+        auto set = static_cast<SparseSet<T>*>(FilterGetSparseSet<T>());
+        assert(set != nullptr);    // no entity in this world has this component type!
+        set->Destroy(local_id);
     }
     
+    // the set that a filter term reads
+    template<typename T>
+    using TermSet = SparseSet<term_component_t<T>>;
+    
+    // does the entry at dense index idx of T's set pass the term's tick condition?
     template<typename T>
-    inline void FilterValidityCheck(entity_t id, void* set, bool& satisfies){
+    static inline bool FilterTicksPass(void* set, entity_t idx, tick_t since){
+        if constexpr (term_checks_ticks<T>){
+            return term_ticks_pass<T>(static_cast<TermSet<T>*>(set)->TicksAt(idx), since);
+        }
+        else{
+            return true;
+        }
+    }
+    
+    // the driving set's entry is known to exist, the others are looked up by owner
+    template<typename T, typename driver_t>
+    inline void FilterValidityCheck(entity_t idx, entity_t owner, void* set, tick_t since, bool& satisfies){
         // in this order so that the first one the entity does not have aborts the rest of them
-        satisfies = satisfies && static_cast<SparseSet<T>*>(set)->HasComponent(id);
+        if constexpr (filter_term<T>::optional || filter_term<T>::resource){
+            return;
+        }
+        else if constexpr (filter_term<T>::excluded){
+            satisfies = satisfies && (set == nullptr || !static_cast<TermSet<T>*>(set)->HasComponent(owner));
+        }
+        else if constexpr (std::is_same_v<T, driver_t>){
+            satisfies = satisfies && FilterTicksPass<T>(set, idx, since);
+        }
+        else{
+            satisfies = satisfies && static_cast<TermSet<T>*>(set)->HasComponent(owner) && FilterTicksPass<T>(set, static_cast<TermSet<T>*>(set)->IndexOf(owner), since);
+        }
     }
     
+    // get by dense index, and mark the component changed if the term asks for it
     template<typename T>
-    inline T& FilterComponentGet(entity_t idx, void* ptr){
-        return static_cast<SparseSet<T>*>(ptr)->Get(idx);
+    inline component_ref_t<term_component_t<T>> FilterTermGet(void* ptr, entity_t idx){
+        auto set = static_cast<TermSet<T>*>(ptr);
+        if constexpr (filter_term<T>::marks){
+            term_mark<T>(set->TicksAt(idx), changeTick);
+        }
+        return set->Get(idx);
+    }
+    
+    // the driving set is read by dense index, the others are looked up by owner
+    template<typename T, typename driver_t>
+    inline component_ref_t<term_component_t<T>> FilterComponentGet(entity_t idx, entity_t owner, void* ptr){
+        if constexpr (std::is_same_v<T, driver_t>){
+            return FilterTermGet<T>(ptr, idx);
+        }
+        else{
+            return FilterTermGet<T>(ptr, static_cast<TermSet<T>*>(ptr)->IndexOf(owner));
+        }
     }
    
+    // @return what the callback receives for a term, as a tuple of zero or one parameters
+    template<typename T, typename driver_t>
+    inline auto FilterArg(entity_t idx, entity_t owner, void* ptr){
+        if constexpr (filter_term<T>::excluded){
+            return std::tuple<>();
+        }
+        else if constexpr (filter_term<T>::resource){
+            return std::tuple<term_component_t<T>&>(*static_cast<term_component_t<T>*>(ptr));
+        }
+        else if constexpr (!term_passes_arg<T>){
+            if constexpr (filter_term<T>::marks){
+                FilterComponentGet<T, driver_t>(idx, owner, ptr);
+            }
+            return std::tuple<>();
+        }
+        else if constexpr (filter_term<T>::optional){
+            static_assert(!is_soa_v<term_component_t<T>>, "SoA components cannot be referred to by pointer");
+            return std::tuple<term_component_t<T>*>(ptr != nullptr ? static_cast<TermSet<T>*>(ptr)->TryGetComponent(owner) : nullptr);
+        }
+        else{
+            return std::tuple<component_ref_t<term_component_t<T>>>(FilterComponentGet<T, driver_t>(idx, owner, ptr));
+        }
+    }
+    
+    // @return the resource for a Resource term, or nullptr for any other term
+    template<typename T>
+    inline void* FilterResource(){
+        if constexpr (filter_term<T>::resource){
+            return TryGetResource<term_component_t<T>>();
+        }
+        else{
+            return nullptr;
+        }
+    }
+    
+    // @return the set a term reads, or the resource for a Resource term
+    template<typename T>
+    inline void* FilterTermPointer(){
+        if constexpr (filter_term<T>::resource){
+            return FilterResource<T>();
+        }
+        else{
+            return FilterGetSparseSet<term_component_t<T>>();
+        }
+    }
+    
+    // @return the set for T, or nullptr if no T has been emplaced in this world
     template<typename T>
     inline void* FilterGetSparseSet(){
-        return componentMap.at(RavEngine::CTTI<T>()).template GetSet<T>();
+        const auto index = ComponentIndex<T>();
+        return index < componentSets.size() && componentSets[index] ? componentSets[index].template GetSet<T>() : nullptr;
+    }
+    
+    // allocate a local id without registering a new global id
+    entity_t CreateLocalID();
+    
+    // make room for n more entities in this world and in the Registry
+    // @return the highest local id the next n entities can get
+    entity_t ReserveEntities(size_t n);
+    
+    entity_t LocalIDOf(entity_id_t global_id) const;
+    
+    std::pmr::vector<resource_ptr<OwningGroup>> groups;
+    
+    // how to walk the sets of a planned query
+    struct QueryRange{
+        pos_t driver = INVALID_INDEX;   // index of the driving set, or INVALID_INDEX if the query cannot match anything
+        size_t begin = 0;               // the first dense entry to walk
+        size_t size = 0;                // one past the last dense entry to walk
+        bool grouped = false;           // the sets are exactly one owning group, so only the shared prefix needs walking
+    };
+    
+    /**
+     The entities in a group's packed prefix have every type in the group. If one of those types is excluded,
+     a set owned by the group can start walking after the prefix.
+     @return the number of leading entries of T's set that cannot match
+     */
+    template<typename T, typename ... A>
+    inline size_t ExcludedPrefix(const std::array<void*, sizeof ... (A)>& ptrs) const{
+        if constexpr (term_required<T> && (filter_term<A>::excluded || ...)){
+            auto set = static_cast<SparseSetBase*>(static_cast<TermSet<T>*>(ptrs[Index_v<T, A...>]));
+            const auto group = set != nullptr ? set->GetGroup() : nullptr;
+            if (group != nullptr && ((filter_term<A>::excluded && ptrs[Index_v<A, A...>] != nullptr && static_cast<SparseSetBase*>(static_cast<TermSet<A>*>(ptrs[Index_v<A, A...>]))->GetGroup() == group) || ...)){
+                return group->size;
+            }
+        }
+        return 0;
+    }
+    
+    /**
+     Resolve the sets a filter needs, and pick the one with the fewest entries to walk to drive the loop.
+     Only required terms can drive.
+     @param ptrs receives the sets in declared order
+     */
+    template<typename ... A>
+    inline QueryRange PlanQuery(std::array<void*, sizeof ... (A)>& ptrs){
+        static_assert((term_required<A> || ...), "A filter needs at least one term that is not Without, Optional or Resource");
+        ptrs = {FilterTermPointer<A>()...};
+        if (((filter_term<A>::resource && ptrs[Index_v<A, A...>] == nullptr) || ...)){
+            return QueryRange();
+        }
+        const std::array<size_t, sizeof ... (A)> sizes{
+            (!term_required<A> ? std::numeric_limits<size_t>::max() : ptrs[Index_v<A, A...>] != nullptr ? static_cast<TermSet<A>*>(ptrs[Index_v<A, A...>])->DenseSize() : 0)...
+        };
+        if (std::find(sizes.begin(), sizes.end(), 0) != sizes.end()){
+            return QueryRange();
+        }
+        const std::array<size_t, sizeof ... (A)> skips{ExcludedPrefix<A, A...>(ptrs)...};
+        size_t driver = 0;
+        for(size_t i = 1; i < sizes.size(); i++){
+            if (sizes[i] - skips[i] < sizes[driver] - skips[driver]){
+                driver = i;
+            }
+        }
+        if constexpr (((term_required<A> && std::is_same_v<term_component_t<A>, Hierarchy>) || ...)){
+            // the Hierarchy set is in depth order, so driving with it visits parents before their children
+            constexpr std::array<bool, sizeof ... (A)> ordered{(term_required<A> && std::is_same_v<term_component_t<A>, Hierarchy>)...};
+            driver = std::find(ordered.begin(), ordered.end(), true) - ordered.begin();
+        }
+        QueryRange range;
+        if (sizes[driver] == skips[driver]){
+            return range;
+        }
+        range.driver = static_cast<pos_t>(driver);
+        range.begin = skips[driver];
+        range.size = sizes[driver];
+        
+        if constexpr ((term_required<A> && ...)){
+            const std::array<OwningGroup*, sizeof ... (A)> groups{static_cast<TermSet<A>*>(ptrs[Index_v<A, A...>])->GetGroup()...};
+            if (groups[0] != nullptr && groups[0]->sets.size() == groups.size() && std::all_of(groups.begin(), groups.end(), [&](auto g){ return g == groups[0]; })){
+                range.grouped = true;
+                range.size = groups[0]->size;
+            }
+        }
+        return range;
+    }
+    
+    // run the body of a filter over a subrange of the driving set's dense array
+    template<typename driver_t, typename ... A, typename func>
+    inline void FilterRangeDriven(const func& f, const std::array<void*, sizeof ... (A)>& ptrs, size_t begin, size_t end, tick_t since){
+        auto mainFilter = static_cast<TermSet<driver_t>*>(ptrs[Index_v<driver_t, A...>]);
+        
+        if constexpr (sizeof ... (A) == 1){
+            for(size_t i = begin; i < end; i++){
+                if (FilterTicksPass<driver_t>(mainFilter, i, since)){
+                    if constexpr (term_direct<driver_t>){
+                        f(FilterTermGet<driver_t>(mainFilter, i));
+                    }
+                    else{
+                        std::apply(f, FilterArg<driver_t, driver_t>(i, mainFilter->GetOwner(i), mainFilter));
+                    }
+                }
+            }
+        }
+        else{
+            // does this entity have all of the other required components?
+            for(size_t i = begin; i < end; i++){
+                const auto owner = mainFilter->GetOwner(i);
+                if (EntityIsValid(owner)){
+                    bool satisfies = true;
+                    (FilterValidityCheck<A, driver_t>(i, owner, ptrs[Index_v<A, A...>], since, satisfies), ...);
+                    if (satisfies){
+                        if constexpr ((term_direct<A> && ...)){
+                            f(FilterComponentGet<A, driver_t>(i, owner, ptrs[Index_v<A, A...>])...);
+                        }
+                        else{
+                            std::apply(f, std::tuple_cat(FilterArg<A, driver_t>(i, owner, ptrs[Index_v<A, A...>])...));
+                        }
+                    }
+                }
+            }
+        }
+    }
+    
+    // every set in an owning group stores its members at the same dense index, so no lookups are needed
+    template<typename ... A, typename func>
+    inline void FilterRangeGrouped(const func& f, const std::array<void*, sizeof ... (A)>& ptrs, size_t begin, size_t end, tick_t since){
+        for(size_t i = begin; i < end; i++){
+            if ((FilterTicksPass<A>(ptrs[Index_v<A, A...>], i, since) && ...)){
+                f(FilterTermGet<A>(ptrs[Index_v<A, A...>], i)...);
+            }
+        }
+    }
+    
+    // dispatch to the loop for whichever set drives this query
+    template<typename ... A, typename func>
+    inline void FilterRange(const func& f, const std::array<void*, sizeof ... (A)>& ptrs, const QueryRange& range, size_t begin, size_t end, tick_t since){
+        if constexpr ((term_direct<A> && ...)){
+            if (range.grouped){
+                FilterRangeGrouped<A...>(f, ptrs, begin, end, since);
+                return;
+            }
+        }
+        ((range.driver == Index_v<A, A...> && (FilterRangeDriven<A, A...>(f, ptrs, begin, end, since), true)) || ...);
+    }
+    
+    // does a FilterChunks body take the owners of its chunk?
+    template<typename func, typename ... A>
+    constexpr static bool wants_owners = std::is_invocable_v<const func&, size_t, A*..., const entity_id_t*>;
+    
+    template<typename ... A, typename func>
+    static inline void InvokeChunk(const func& f, size_t count, const entity_id_t* owners, A* ... columns){
+        if constexpr (wants_owners<func, A...>){
+            f(count, columns..., owners);
+        }
+        else{
+            f(count, columns...);
+        }
+    }
+    
+    // forwards to the world's memory resource under a lock. Systems that run at the same time in a Tick allocate their scratch from here,
+    // because the world's resource, such as a std::pmr::monotonic_buffer_resource, need not be thread safe.
+    // It also keeps the scratch blocks that FilterChunks gives back, so that a filter run every frame doesn't allocate every frame.
+    class ScratchResource : public std::pmr::memory_resource{
+        constexpr static size_t max_pooled_blocks = 16;
+        struct Block{
+            void* data;
+            size_t bytes;
+            size_t alignment;
+        };
+        std::pmr::memory_resource* const upstream;
+        std::mutex mtx;
+        std::array<Block, max_pooled_blocks> pool;
+        size_t n_pooled = 0;
+        
+        void* do_allocate(size_t bytes, size_t alignment) final{
+            std::lock_guard<std::mutex> lock(mtx);
+            return upstream->allocate(bytes, alignment);
+        }
+        void do_deallocate(void* ptr, size_t bytes, size_t alignment) final{
+            std::lock_guard<std::mutex> lock(mtx);
+            upstream->deallocate(ptr, bytes, alignment);
+        }
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept final{
+            return this == &other;
+        }
+    public:
+        ScratchResource(std::pmr::memory_resource* upstream) : upstream(upstream){}
+        ScratchResource(const ScratchResource&) = delete;
+        
+        ~ScratchResource(){
+            for(size_t i = 0; i < n_pooled; i++){
+                upstream->deallocate(pool[i].data, pool[i].bytes, pool[i].alignment);
+            }
+        }
+        
+        // @return a pooled block of this size and alignment, or a new one
+        inline void* TakeBlock(size_t bytes, size_t alignment){
+            std::lock_guard<std::mutex> lock(mtx);
+            for(size_t i = 0; i < n_pooled; i++){
+                if (pool[i].bytes == bytes && pool[i].alignment == alignment){
+                    auto data = pool[i].data;
+                    pool[i] = pool[--n_pooled];
+                    return data;
+                }
+            }
+            return upstream->allocate(bytes, alignment);
+        }
+        
+        // pool a block from TakeBlock, or free it if the pool is full
+        inline void GiveBlock(void* data, size_t bytes, size_t alignment){
+            std::lock_guard<std::mutex> lock(mtx);
+            if (n_pooled < max_pooled_blocks){
+                pool[n_pooled++] = {data, bytes, alignment};
+            }
+            else{
+                upstream->deallocate(data, bytes, alignment);
+            }
+        }
+    };
+    ScratchResource scratchResource{resource};
+    
+    // uninitialized, aligned room for one chunk of components, taken from the world's scratch pool
+    template<typename T>
+    struct ScratchBlock{
+        constexpr static size_t alignment = std::max<size_t>(alignof(T), 64);
+        ScratchResource* scratch;
+        T* data;
+        
+        ScratchBlock(ScratchResource* scratch) : scratch(scratch), data(static_cast<T*>(scratch->TakeBlock(sizeof(T) * filter_chunk_size, alignment))){}
+        ScratchBlock(const ScratchBlock&) = delete;
+        ScratchBlock(ScratchBlock&& other) : scratch(other.scratch), data(other.data){
+            other.data = nullptr;
+        }
+        ~ScratchBlock(){
+            if (data != nullptr){
+                scratch->GiveBlock(data, sizeof(T) * filter_chunk_size, alignment);
+            }
+        }
+    };
+    
+    // a term's component goes into scratch. A const term's is copied and left in place, anything else is moved out.
+    template<typename A, typename T>
+    static inline void Gather(T* dest, T& src){
+        if constexpr (std::is_const_v<A>){
+            new (dest) T(std::as_const(src));
+        }
+        else{
+            new (dest) T(std::move(src));
+        }
+    }
+    
+    // a term's component comes out of scratch. Only a term that isn't const is moved back.
+    template<typename A, typename T>
+    static inline void Scatter(T& scratch, T& dest){
+        if constexpr (!std::is_const_v<A>){
+            dest = std::move(scratch);
+        }
+        scratch.~T();
+    }
+    
+    // walk the driving set, gather the components of each chunk of matching entities into scratch blocks, and scatter them back after f.
+    // When the chunk's entities are a contiguous run of the driving set, its array is passed as it is instead.
+    // The terms A may be const, which the driver is not.
+    template<typename driver_t, typename ... A, typename func>
+    inline void FilterChunksGathered(const func& f, const std::array<void*, sizeof ... (A)>& ptrs, size_t size){
+        auto driver = static_cast<SparseSet<driver_t>*>(ptrs[Index_v<driver_t, std::remove_const_t<A>...>]);
+        std::tuple<ScratchBlock<std::remove_const_t<A>>...> scratch{ScratchBlock<std::remove_const_t<A>>(&scratchResource)...};
+        std::array<entity_t, filter_chunk_size> locals;
+        std::array<entity_id_t, filter_chunk_size> owners;
+        using driver_term = std::tuple_element_t<Index_v<driver_t, std::remove_const_t<A>...>, std::tuple<A...>>;
+        driver_term* driverColumn = nullptr;
+        
+        // the column f gets for a term. The unused pointer parameter names the term.
+        auto column = [&](auto* term){
+            using term_t = std::remove_pointer_t<decltype(term)>;
+            if constexpr (std::is_same_v<std::remove_const_t<term_t>, driver_t>){
+                return driverColumn;
+            }
+            else{
+                return static_cast<term_t*>(std::get<ScratchBlock<std::remove_const_t<term_t>>>(scratch).data);
+            }
+        };
+        
+        size_t i = 0;
+        while(i < size){
+            size_t count = 0;
+            size_t first = i;
+            bool contiguous = true;
+            for(; i < size && count < filter_chunk_size; i++){
+                const auto owner = driver->GetOwner(i);
+                if (!EntityIsValid(owner)){
+                    contiguous = false;
+                    continue;
+                }
+                bool satisfies = true;
+                (FilterValidityCheck<std::remove_const_t<A>, driver_t>(i, owner, ptrs[Index_v<A, A...>], 0, satisfies), ...);
+                if (satisfies){
+                    if (count == 0){
+                        first = i;
+                        contiguous = true;
+                    }
+                    // the driver is gathered once the chunk is complete, if it has to be
+                    ((std::is_same_v<std::remove_const_t<A>, driver_t> || (Gather<A>(std::get<ScratchBlock<std::remove_const_t<A>>>(scratch).data + count, FilterComponentGet<std::remove_const_t<A>, driver_t>(i, owner, ptrs[Index_v<A, A...>])), true)), ...);
+                    locals[count] = owner;
+                    if constexpr (wants_owners<func, A...>){
+                        owners[count] = localToGlobal[owner];
+                    }
+                    count++;
+                }
+                else if (count > 0){
+                    contiguous = false;
+                }
+            }
+            if (count == 0){
+                continue;
+            }
+            if (contiguous){
+                driverColumn = &driver->Get(first);
+            }
+            else{
+                auto gathered = std::get<ScratchBlock<driver_t>>(scratch).data;
+                for(size_t k = 0; k < count; k++){
+                    Gather<driver_term>(gathered + k, driver->GetComponent(locals[k]));
+                }
+                driverColumn = gathered;
+            }
+            InvokeChunk<A...>(f, count, owners.data(), column(static_cast<A*>(nullptr))...);
+            for(size_t k = 0; k < count; k++){
+                (((contiguous && std::is_same_v<std::remove_const_t<A>, driver_t>) || (Scatter<A>(std::get<ScratchBlock<std::remove_const_t<A>>>(scratch).data[k], static_cast<SparseSet<std::remove_const_t<A>>*>(ptrs[Index_v<A, A...>])->GetComponent(locals[k])), true)), ...);
+            }
+        }
     }
     
-    entity_t CreateEntity();
+    entity_id_t CreateEntity();
+    
+    // copy every component of an entity onto a new entity in this world. Aborts if a component is not copy constructible.
+    // @return the global id of the copy
+    entity_id_t CloneEntity(entity_t local_id);
 
 public:
+    constexpr static size_t default_grain_size = 16384;
+    constexpr static size_t filter_chunk_size = 4096;   // the most entities FilterChunks passes at once
+    
+    /**
+     @param storageMode how components are laid out in memory
+     @param resource where this world's component arrays, id arrays and bookkeeping are allocated.
+     An arena such as std::pmr::monotonic_buffer_resource lets a whole world be released at once, without freeing each array.
+     It must outlive the world.
+     */
+    World(WorldStorage storageMode = WorldStorage::SparseSet, std::pmr::memory_resource* resource = std::pmr::get_default_resource()) :
+        resource(resource),
+        localToGlobal(resource),
+        storageMode(storageMode),
+        archetypes(&changeTick, resource),
+        componentSets(resource),
+        signatures(resource),
+        hierarchyOrder(resource),
+        resources(resource),
+        observers(resource),
+        groups(resource){}
+    World(const World&) = delete;
+    
+    inline WorldStorage GetStorageMode() const{
+        return storageMode;
+    }
+    
+    /**
+     Components are stamped with the change tick when they are emplaced, marked changed, or visited through a Mut term.
+     The tick starts at 1, so a filter with since = 0 sees every component as added and changed.
+     */
+    inline tick_t GetChangeTick() const{
+        return changeTick;
+    }
+    
+    /**
+     Begin a new change tick. A system that filters on Added or Changed terms calls this before it runs,
+     and passes the tick it got back last time as the filter's since, so that it sees every change made after its previous run, but not its own.
+     Ticks are not compared with wraparound, so a world can be advanced about four billion times.
+     @return the new tick
+     */
+    inline tick_t AdvanceChangeTick(){
+        return ++changeTick;
+    }
+    
+    /**
+     Choose the order in which the local ids of destroyed entities are reused
+     */
+    inline void SetIDReuseOrder(IDReuse order){
+        available.set_order(localToGlobal, order);
+    }
+    
+    /**
+     Add a system to run on every Tick. Declare what it touches with Access, for example AddSystem<Reads<Velocity>, Writes<Position>>.
+     Systems that don't conflict run concurrently, so a system must only touch what it declares. See Scheduler.hpp.
+     @param f invoked as f(World&), or as f(World&, tick_t since), where since is the change tick of the system's previous run,
+     to pass to Filter for Added and Changed terms
+     */
+    template<typename ... Access, typename func>
+    inline void AddSystem(std::string_view name, func&& f){
+        Scheduler::System system;
+        system.name = name;
+        (AddAccess(Access{}, system), ...);
+        if constexpr (std::is_invocable_v<func&, World&, tick_t>){
+            system.run = std::forward<func>(f);
+        }
+        else{
+            system.run = [f = std::forward<func>(f)](World& world, tick_t) mutable{
+                f(world);
+            };
+        }
+        scheduler.Add(std::move(system));
+    }
+    
+    /**
+     Run every system once, a stage at a time. The systems in a stage run concurrently on the pool.
+     The scratch that filters allocate is taken from the world's memory resource under a lock, so the resource need not be thread safe.
+     The change tick advances before each stage, so a system sees the changes made since it last ran, including by the systems after it, but not its own.
+     */
+    void Tick(ThreadPool& pool = ThreadPool::Shared());
+    
+    // @return the duration of each system in the last Tick, and the critical path through them
+    inline const TickReport& GetTickReport() const{
+        return scheduler.report;
+    }
+    
     template<typename T, typename ... A>
-    inline T CreatePrototype(A ... args){
+    inline T CreatePrototype(A&& ... args){
         auto id = CreateEntity();
         T en;
         en.id = id;
-        en.Create(args...);
+        en.Create(std::forward<A>(args)...);
         return en;
     }
     
+    /**
+     Create many entities of the same prototype at once. Space for the entities and for every component the
+     prototype emplaces is reserved up front.
+     @param n the number of entities to create
+     @param init invoked as init(T& entity, size_t i) after each entity's Create
+     */
+    template<typename T, typename func>
+    inline void CreatePrototypes(size_t n, const func& init){
+        if (n == 0){
+            return;
+        }
+        const auto max_local_id = ReserveEntities(n);
+        
+        // the first entity discovers which components the prototype uses
+        auto first = CreatePrototype<T>();
+        init(first, 0);
+        if (storageMode == WorldStorage::Archetype){
+            archetypes.Reserve(LocalIDOf(first.id), n - 1, max_local_id);
+        }
+        else{
+            EnumerateComponentsOn(LocalIDOf(first.id), [&](SparseSetErased& sp_erased){
+                sp_erased.GetBase()->Reserve(n - 1, max_local_id);
+            });
+        }
+        for(size_t i = 1; i < n; i++){
+            auto en = CreatePrototype<T>();
+            init(en, i);
+        }
+    }
+    
+    /**
+     Destroy every entity in this world. Each component set is emptied in one step, instead of entity by entity. Resources are kept.
+     */
+    void Clear();
+    
+    /**
+     Play back the commands recorded in a buffer, then clear it. Defined in CommandBuffer.hpp.
+     @return the entities the buffer created, in the order their creates were recorded
+     */
+    std::vector<Entity> Apply(CommandBuffer& buffer);
+    
+    // create many entities of the same prototype, with the components its Create emplaces
+    template<typename T>
+    inline void CreatePrototypes(size_t n){
+        CreatePrototypes<T>(n, [](T&, size_t){});
+    }
+    
+    /**
+     Keep the entities that have all of A packed at the front of each of A's sets, in the same order.
+     A Filter over exactly these types then walks the packed prefix without any lookups.
+     Each set can be owned by at most one group. Archetype storage already packs entities this way, so this does nothing there.
+     */
+    template<typename ... A>
+    inline void CreateGroup(){
+        static_assert(sizeof ... (A) > 1, "A group needs at least two types");
+        if (storageMode == WorldStorage::Archetype){
+            return;
+        }
+        groups.push_back(make_resource_ptr<OwningGroup>(resource, resource));
+        auto group = groups.back().get();
+        group->sets = {static_cast<SparseSetBase*>(MakeIfNotExists<A>())...};
+        for(auto set : group->sets){
+            assert(set->GetGroup() == nullptr);    // a set can be owned by only one group
+            assert(set->depthOrder == nullptr);    // the Hierarchy set keeps its own order
+            set->group = group;
+        }
+        // pack the entities that already qualify
+        auto smallest = *std::min_element(group->sets.begin(), group->sets.end(), [](auto a, auto b){
+            return a->aux_set.size() < b->aux_set.size();
+        });
+        for(size_t i = 0; i < smallest->aux_set.size(); i++){
+            group->OnEmplace(smallest->GetOwner(i));
+        }
+    }
+    
+    /**
+     Construct the world's T resource, replacing the one it has. Resources hold per-world state, such as time or settings,
+     without a component on a placeholder entity. They stay until they are removed or the world is destroyed, Clear keeps them.
+     @return the new resource
+     */
+    template<typename T, typename ... A>
+    inline T& SetResource(A&& ... args){
+        const auto index = ComponentIndex<T>();
+        if (index >= resources.size()){
+            resources.resize(index + 1);
+        }
+        std::pmr::polymorphic_allocator<T> alloc(resource);
+        ResourceSlot slot;
+        slot.data = new (alloc.allocate(1)) T(std::forward<A>(args)...);
+        slot.dealloc = [](void* data, std::pmr::memory_resource* resource){
+            static_cast<T*>(data)->~T();
+            std::pmr::polymorphic_allocator<T>(resource).deallocate(static_cast<T*>(data), 1);
+        };
+        slot.resource = resource;
+        resources[index] = std::move(slot);
+        return *static_cast<T*>(resources[index].data);
+    }
+    
+    // @return the world's T resource, or nullptr if it has none
+    template<typename T>
+    inline T* TryGetResource(){
+        const auto index = ComponentIndex<T>();
+        return index < resources.size() ? static_cast<T*>(resources[index].data) : nullptr;
+    }
+    
+    template<typename T>
+    inline T& GetResource(){
+        auto ptr = TryGetResource<T>();
+        assert(ptr != nullptr);    // this world has no resource of this type!
+        return *ptr;
+    }
+    
+    template<typename T>
+    inline bool HasResource(){
+        return TryGetResource<T>() != nullptr;
+    }
+    
+    template<typename T>
+    inline void RemoveResource(){
+        const auto index = ComponentIndex<T>();
+        if (index < resources.size()){
+            resources[index] = ResourceSlot();
+        }
+    }
+    
+    /**
+     Reorder the components of type T by cmp(const T&, const T&), so that filters driven by T visit them in that order.
+     In sparse-set storage, T's set is sorted and the entities' other components stay where they are.
+     In archetype storage, each archetype that stores T sorts its rows by T.
+     Runs in O(n log n), and allocates only a scratch permutation from the world's memory resource.
+     T's set must not be owned by a group.
+     */
+    template<typename T, typename Compare>
+    inline void Sort(const Compare& cmp){
+        if (storageMode == WorldStorage::Archetype){
+            archetypes.Sort<T>(cmp);
+            return;
+        }
+        auto set = static_cast<SparseSet<T>*>(FilterGetSparseSet<T>());
+        if (set != nullptr){
+            set->Sort(cmp, &scratchResource);
+        }
+    }
+    
+    /**
+     Arrange T's set in the entity order of U's set. Entities that have both come first, in U's order, so that a filter over both
+     walks the two arrays sequentially. Runs in O(size of U) without allocating. T's set must not be owned by a group.
+     Archetype storage keeps each entity's components in the same row already, so this does nothing there.
+     */
+    template<typename T, typename U>
+    inline void SortAs(){
+        if (storageMode == WorldStorage::Archetype){
+            return;
+        }
+        auto set = static_cast<SparseSet<T>*>(FilterGetSparseSet<T>());
+        auto other = static_cast<SparseSet<U>*>(FilterGetSparseSet<U>());
+        if (set != nullptr && other != nullptr){
+            set->SortAs(*other);
+        }
+    }
+    
+    /**
+     Observe an event on a component type in this world. Events are queued per type, and delivered in batches by DeliverEvents.
+     Only observed types and events are queued.
+     @param f invoked as f(const entity_id_t* entities, size_t count) for each run of consecutive T events of this kind.
+     Removed entities may no longer be alive by the time their event is delivered.
+     */
+    template<typename T, typename func>
+    inline void Observe(ComponentEvent event, func&& f){
+        const auto index = ComponentIndex<T>();
+        if (index >= observers.size()){
+            observers.resize(index + 1);
+        }
+        if (!observers[index]){
+            observers[index] = make_resource_ptr<TypeObservers>(resource, resource);
+        }
+        observers[index]->observers[size_t(event)].emplace_back(std::forward<func>(f));
+    }
+    
+    /**
+     Deliver the queued events of each observed type, one type at a time. Within a type, events arrive in the order they happened,
+     grouped into runs of the same kind, so an entity that lost and regained a component is seen in that order.
+     Observers may change the world. Events they cause are delivered on the next call.
+     */
+    void DeliverEvents();
+    
+    /**
+     Invoke f on every entity that has all of A, passing the components in the declared order.
+     Each of A is a component type or a filter term wrapping one, such as Changed<T>. See FilterTerms.hpp.
+     The smallest of the sets drives the loop, regardless of the order of A.
+     If A is exactly the types of an owning group, the loop walks the group instead.
+     A Hierarchy term always drives, so that in sparse-set storage, parents are visited before their children.
+     @param since Added and Changed terms match components stamped after this tick, such as the tick a system last ran at
+     */
     template<typename ... A, typename func>
-    inline void Filter(const func& f){
+    inline void Filter(const func& f, tick_t since = 0){
         constexpr auto n_types = sizeof ... (A);
         static_assert(n_types > 0, "Must supply a type to query for");
         
-        using primary_t = typename std::tuple_element<0, std::tuple<A...> >::type;
+        if (storageMode == WorldStorage::Archetype){
+            const std::array<void*, n_types> resources{FilterResource<A>()...};
+            if (((filter_term<A>::resource && resources[Index_v<A, A...>] == nullptr) || ...)){
+                return;
+            }
+            archetypes.Filter<A...>(f, resources, since);
+            return;
+        }
+        std::array<void*, n_types> ptrs;
+        const auto range = PlanQuery<A...>(ptrs);
+        if (!PosIsValid(range.driver)){
+            return;
+        }
+        FilterRange<A...>(f, ptrs, range, range.begin, range.size, since);
+    }
+    
+    /**
+     Like Filter, but the driving set is split into ranges of grainSize entries, which run concurrently on a work-stealing pool.
+     In archetype storage, whole chunks are handed out instead, as many as fit in grainSize entries.
+     f is invoked from several threads at once, so it must only write to the components it is given.
+     Ranges of a Hierarchy set are not ordered against each other, so parents are not always visited first.
+     Components and entities must not be added or removed until ParallelFilter returns.
+     @param grainSize the number of entries each task processes
+     @param pool the pool to run on. Its thread count determines the parallelism.
+     @param since as in Filter
+     */
+    template<typename ... A, typename func>
+    inline void ParallelFilter(const func& f, size_t grainSize = default_grain_size, ThreadPool& pool = ThreadPool::Shared(), tick_t since = 0){
+        constexpr auto n_types = sizeof ... (A);
+        static_assert(n_types > 0, "Must supply a type to query for");
         
-        if constexpr (n_types == 1){
-            auto mainFilter = GetRange<primary_t>();
-            for(size_t i = 0; i < mainFilter->DenseSize(); i++){
-                auto& item = mainFilter->Get(i);
-                f(item);
+        if (storageMode == WorldStorage::Archetype){
+            const std::array<void*, n_types> resources{FilterResource<A>()...};
+            if (((filter_term<A>::resource && resources[Index_v<A, A...>] == nullptr) || ...)){
+                return;
             }
+            archetypes.ParallelFilter<A...>(f, resources, grainSize, pool, since, &scratchResource);
+            return;
         }
-        else{
-            std::array<void*, n_types> ptrs{ FilterGetSparseSet<A>()...};
-            auto mainFilter = static_cast<SparseSet<primary_t>*>(ptrs[0]);
-            // does this entity have all of the other required components?
-            for(size_t i = 0; i < mainFilter->DenseSize(); i++){
-                const auto owner = mainFilter->GetOwner(i);
-                if (EntityIsValid(owner)){
-                    bool satisfies = true;
-                    (FilterValidityCheck<A>(owner, ptrs[Index_v<A, A...>], satisfies), ...);
-                    if (satisfies){
-                        f(FilterComponentGet<A>(i,ptrs[Index_v<A, A...>])...);
+        std::array<void*, n_types> ptrs;
+        const auto range = PlanQuery<A...>(ptrs);
+        if (!PosIsValid(range.driver)){
+            return;
+        }
+        pool.ParallelFor(range.begin, range.size, grainSize, [&](size_t begin, size_t end){
+            FilterRange<A...>(f, ptrs, range, begin, end, since);
+        });
+    }
+    
+    /**
+     Invoke f(count, A* ..., const entity_id_t* owners) on blocks of up to filter_chunk_size entities that have all of A.
+     Each array holds count entries, contiguous, so f can run a vectorized or hand-written SIMD loop over them.
+     f may leave off the owners parameter, in which case the owning entities are not looked up.
+     With a single type, with an owning group over exactly A, or in archetype storage, the arrays point into the storage itself.
+     Otherwise the matching components are moved into aligned scratch blocks, which are moved back once f returns.
+     A type given as const T is passed as const T*, and is copied into scratch instead, and not written back,
+     so systems that only read T can filter it at the same time. The scratch blocks are kept for the next call.
+     Components and entities must not be added or removed inside f.
+     */
+    template<typename ... A, typename func>
+    inline void FilterChunks(const func& f){
+        constexpr auto n_types = sizeof ... (A);
+        static_assert(n_types > 0, "Must supply a type to query for");
+        static_assert((!is_soa_v<std::remove_const_t<A>> && ...), "SoA components are not stored contiguously per component");
+        static_assert((std::is_same_v<std::remove_const_t<A>, term_component_t<std::remove_const_t<A>>> && ...), "Filter terms are not supported here, use Filter");
+        static_assert((!std::is_empty_v<A> && ...), "Tag components have no arrays to pass, use Filter");
+        static_assert(((!std::is_const_v<A> || std::is_copy_constructible_v<A>) && ...), "const components are copied into scratch, so they must be copy constructible");
+        
+        std::array<entity_id_t, filter_chunk_size> owners;
+        if (storageMode == WorldStorage::Archetype){
+            archetypes.FilterChunks<std::remove_const_t<A>...>([&](size_t count, const entity_t* locals, std::remove_const_t<A>* ... columns){
+                assert(count <= filter_chunk_size);
+                if constexpr (wants_owners<func, A...>){
+                    for(size_t i = 0; i < count; i++){
+                        owners[i] = localToGlobal[locals[i]];
                     }
                 }
+                InvokeChunk<A...>(f, count, owners.data(), columns...);
+            });
+            return;
+        }
+        std::array<void*, n_types> ptrs;
+        const auto range = PlanQuery<std::remove_const_t<A>...>(ptrs);
+        if (!PosIsValid(range.driver)){
+            return;
+        }
+        if (n_types == 1 || range.grouped){
+            // every set stores the entities at the same dense index
+            const std::tuple<SparseSet<std::remove_const_t<A>>*...> sets{static_cast<SparseSet<std::remove_const_t<A>>*>(ptrs[Index_v<A, A...>])...};
+            auto first = static_cast<SparseSetBase*>(std::get<0>(sets));
+            for(size_t begin = 0; begin < range.size; begin += filter_chunk_size){
+                const auto count = std::min(filter_chunk_size, range.size - begin);
+                if constexpr (wants_owners<func, A...>){
+                    for(size_t i = 0; i < count; i++){
+                        owners[i] = localToGlobal[first->GetOwner(begin + i)];
+                    }
+                }
+                InvokeChunk<A...>(f, count, owners.data(), &std::get<SparseSet<std::remove_const_t<A>>*>(sets)->Get(begin)...);
             }
+            return;
         }
+        ((range.driver == Index_v<A, A...> && (FilterChunksGathered<std::remove_const_t<A>, A...>(f, ptrs, range.size), true)) || ...);
     }
     
-    // this does not check if the entity actually has the component
-    // instead it iterates over keys in the hashtable
+    // invoke fn on each set the entity has a component in. Only for sparse-set storage.
     template<typename func_t>
     inline void EnumerateComponentsOn(entity_t local_id, const func_t& fn){
-        for(auto& componentRow : componentMap){
-            auto& sp_erased = componentRow.second;
-            fn(sp_erased);
-        }
+        signatures.for_each(local_id, [&](size_t bit){
+            fn(componentSets[bit]);
+        });
     }
     
+    // move an entity and its descendants in from another world. The entity leaves its parent behind, and becomes a root here.
+    void AddSubtreeFrom(World* other, entity_t other_local_id);
+    
     // return the new local id
     inline entity_t AddEntityFrom(World* other,entity_t other_local_id){
-        auto newID = CreateEntity();
+        auto newID = CreateLocalID();
+        localToGlobal[newID] = other->localToGlobal[other_local_id];
+        other->RecordEventOnAll(ComponentEvent::MovedOut, other_local_id);
         
-        other->EnumerateComponentsOn(other_local_id, [&](SparseSetErased& sp_erased){
-            // call the moveFn to move the other entity data into this
-            sp_erased.moveFn(other_local_id,newID,this);
-        });
-        other->localToGlobal[other_local_id] = INVALID_ENTITY;
+        if (other->storageMode == WorldStorage::Archetype){
+            if (storageMode == WorldStorage::Archetype){
+                archetypes.MoveFrom(other->archetypes, other_local_id, newID);
+            }
+            else{
+                other->archetypes.MoveTo(other_local_id, this, newID);
+            }
+        }
+        else{
+            other->EnumerateComponentsOn(other_local_id, [&](SparseSetErased& sp_erased){
+                // move the other entity data into this
+                sp_erased.Ops().moveToWorld(sp_erased.GetBase(), other_local_id, this, newID);
+            });
+        }
+        RecordEventOnAll(ComponentEvent::MovedIn, newID);
+        other->available.push(other->localToGlobal, other_local_id);
         return newID;
     }
     
     ~World();
 };
+
+template<typename T>
+const ComponentTypeInfo& GetComponentTypeInfo(){
+    static constexpr ComponentTypeInfo info{
+        RavEngine::CTTI<T>(),
+        std::is_empty_v<T> ? 0 : sizeof(T),    // tags take no room in a chunk, every row constructs them at the column's address
+        alignof(T),
+        [](void* dest, void* src){
+            new (dest) T(std::move(*static_cast<T*>(src)));
+        },
+        [](void* ptr){
+            static_cast<T*>(ptr)->~T();
+        },
+        [](void* a, void* b){
+            using std::swap;
+            swap(*static_cast<T*>(a), *static_cast<T*>(b));
+        },
+        &World::MoveComponentToWorld<T>,
+        std::is_copy_constructible_v<T> ? &World::CopyComponentToWorld<T> : nullptr,
+        &World::ComponentIndex<T>
+    };
+    return info;
+}
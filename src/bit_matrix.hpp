@@ -0,0 +1,106 @@
+#pragma once
+#include <vector>
+#include <memory_resource>
+#include <cstdint>
+#include <cstddef>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+/**
+ The Bit Matrix stores a row of bits for each index, in one flat array.
+ - Rows grow on demand when a bit is set in a row past the end
+ - Columns grow on demand too, which re-lays out the array. Columns are expected to be added rarely.
+ @note reading a row that was never written returns no bits
+ */
+class bit_matrix{
+    typedef uint64_t word_t;
+    constexpr static size_t word_bits = sizeof(word_t) * 8;
+
+    std::pmr::vector<word_t> words;
+    size_t row_words = 1;   // words per row
+    size_t n_rows = 0;
+
+    static inline size_t lowest_bit(word_t word){
+#if defined(_MSC_VER)
+        unsigned long idx;
+        _BitScanForward64(&idx, word);
+        return idx;
+#else
+        return __builtin_ctzll(word);
+#endif
+    }
+
+    // make room for a column, copying every row to the wider stride
+    inline void grow_columns(size_t bit){
+        const auto new_row_words = bit / word_bits + 1;
+        std::pmr::vector<word_t> grown(n_rows * new_row_words, 0, words.get_allocator());
+        for(size_t row = 0; row < n_rows; row++){
+            for(size_t w = 0; w < row_words; w++){
+                grown[row * new_row_words + w] = words[row * row_words + w];
+            }
+        }
+        words = std::move(grown);
+        row_words = new_row_words;
+    }
+
+public:
+    typedef size_t index_type;
+
+    bit_matrix(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) : words(resource){}
+
+    inline size_t rows() const{
+        return n_rows;
+    }
+
+    inline void set(index_type row, size_t bit){
+        if (bit >= row_words * word_bits){
+            grow_columns(bit);
+        }
+        if (row >= n_rows){
+            n_rows = row + 1;
+            words.resize(n_rows * row_words, 0);
+        }
+        words[row * row_words + bit / word_bits] |= word_t(1) << (bit % word_bits);
+    }
+
+    inline void reset(index_type row, size_t bit){
+        if (row < rows() && bit < row_words * word_bits){
+            words[row * row_words + bit / word_bits] &= ~(word_t(1) << (bit % word_bits));
+        }
+    }
+
+    inline bool test(index_type row, size_t bit) const{
+        return row < rows() && bit < row_words * word_bits && (words[row * row_words + bit / word_bits] >> (bit % word_bits)) & 1;
+    }
+
+    /**
+     Invoke f(bit) for each set bit in a row, in ascending order.
+     f may set or reset bits in existing columns, including in this row, but must not add columns.
+     Bits changed in this row during the loop may or may not be visited.
+     */
+    template<typename func>
+    inline void for_each(index_type row, const func& f) const{
+        if (row >= rows()){
+            return;
+        }
+        // read by index each time, f may grow the rows and reallocate the array
+        for(size_t w = 0; w < row_words; w++){
+            auto word = words[row * row_words + w];
+            while(word != 0){
+                f(w * word_bits + lowest_bit(word));
+                word &= word - 1;
+            }
+        }
+    }
+
+    // make room for n rows
+    inline void reserve(index_type n){
+        words.reserve(n * row_words);
+    }
+
+    inline void clear(){
+        words.clear();
+        n_rows = 0;
+    }
+};
@@ -0,0 +1,100 @@
+#pragma once
+#include "Types.hpp"
+#include <algorithm>
+
+// the order in which released ids are handed out again
+enum class IDReuse : uint8_t{
+    LIFO,           // most recently released first, whose slot is most likely still in cache
+    LowestFirst     // lowest released id first, which keeps id-indexed arrays short
+};
+
+/**
+ The Implicit Free List tracks the free slots of an id-indexed array without a separate container.
+ A free slot stores the index of the next free slot in place of its data.
+ @param traits describes how a slot is marked free. Must provide:
+    static bool is_free(const slot&)
+    static entity_t next(const slot&)
+    static void set_free(slot&, entity_t next)
+ */
+template<typename traits>
+class implicit_free_list{
+    entity_t head = INVALID_ENTITY;     // first free slot, in LIFO order
+    entity_t lowest = 0;                // in LowestFirst order, no slot below this is free
+    size_t n_free = 0;
+    IDReuse order = IDReuse::LIFO;
+
+public:
+    /**
+     Take a free slot
+     @param slots the array the free list is threaded through
+     @return the index of the slot, or INVALID_ENTITY if there are no free slots. The caller must overwrite the slot.
+     */
+    template<typename vec_t>
+    inline entity_t pop(vec_t& slots){
+        if (n_free == 0){
+            return INVALID_ENTITY;
+        }
+        entity_t id;
+        if (order == IDReuse::LIFO){
+            id = head;
+            head = traits::next(slots[id]);
+        }
+        else{
+            id = lowest;
+            while(!traits::is_free(slots[id])){
+                id++;
+            }
+            lowest = id + 1;
+        }
+        n_free--;
+        return id;
+    }
+
+    /**
+     Mark a slot as free
+     @param slots the array the free list is threaded through
+     @param id the index of the slot
+     */
+    template<typename vec_t>
+    inline void push(vec_t& slots, entity_t id){
+        if (order == IDReuse::LIFO){
+            traits::set_free(slots[id], head);
+            head = id;
+        }
+        else{
+            traits::set_free(slots[id], INVALID_ENTITY);
+            lowest = std::min(lowest, id);
+        }
+        n_free++;
+    }
+
+    /**
+     Change the reuse order. Complexity is O(n) in the number of slots.
+     @param slots the array the free list is threaded through
+     */
+    template<typename vec_t>
+    inline void set_order(vec_t& slots, IDReuse newOrder){
+        order = newOrder;
+        head = INVALID_ENTITY;
+        lowest = 0;
+        n_free = 0;
+        // rebuild from the back, so that in LIFO order the lowest id ends up at the head
+        for(size_t i = slots.size(); i > 0; i--){
+            const auto id = static_cast<entity_t>(i - 1);
+            if (traits::is_free(slots[id])){
+                push(slots, id);
+            }
+        }
+    }
+
+    // forget every free slot, for when the array is emptied. The reuse order is kept.
+    inline void clear(){
+        head = INVALID_ENTITY;
+        lowest = 0;
+        n_free = 0;
+    }
+
+    inline size_t size() const{
+        return n_free;
+    }
+};
@@ -0,0 +1,157 @@
+#pragma once
+#include <vector>
+#include <array>
+#include <memory>
+#include <memory_resource>
+#include <cstdint>
+#include <cassert>
+
+/**
+ The Paged Sparse Array maps indices to values, like a vector that is mostly empty.
+ - Storage is split into fixed-size pages, which are only allocated once a valid value is stored in them
+ - A page is freed again once every entry in it is invalid
+ Memory therefore scales with the number of occupied pages, not with the highest index stored.
+ @param T the value type
+ @param invalid the value of an empty entry
+ @param page_size entries per page. Must be a power of two.
+ @note the page directory and the pages are allocated from the memory resource passed at construction
+ */
+template<typename T, T invalid, size_t page_size = 4096>
+class paged_sparse_array{
+    static_assert((page_size & (page_size - 1)) == 0, "page_size must be a power of two");
+
+    struct page{
+        std::array<T, page_size> entries;
+        size_t live = 0;   // number of valid entries
+
+        page(){
+            entries.fill(invalid);
+        }
+    };
+
+    std::pmr::vector<page*> pages;
+    size_t n_pages = 0;
+
+    inline void free_page(page*& p){
+        std::pmr::polymorphic_allocator<page> alloc(pages.get_allocator());
+        p->~page();
+        alloc.deallocate(p, 1);
+        p = nullptr;
+    }
+
+    constexpr static size_t page_of(size_t idx){
+        return idx / page_size;
+    }
+
+    constexpr static size_t offset_of(size_t idx){
+        return idx & (page_size - 1);
+    }
+
+public:
+    typedef size_t index_type;
+
+    paged_sparse_array(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) : pages(resource){}
+    paged_sparse_array(const paged_sparse_array&) = delete;
+    paged_sparse_array(paged_sparse_array&& other) : pages(std::move(other.pages)), n_pages(other.n_pages){
+        other.pages.clear();
+        other.n_pages = 0;
+    }
+
+    ~paged_sparse_array(){
+        clear();
+    }
+
+    /**
+     @return the value at idx, or invalid if nothing is stored there. Complexity is O(1).
+     */
+    inline T get(index_type idx) const{
+        const auto p = page_of(idx);
+        if (p < pages.size() && pages[p] != nullptr){
+            return pages[p]->entries[offset_of(idx)];
+        }
+        return invalid;
+    }
+
+    inline bool contains(index_type idx) const{
+        return get(idx) != invalid;
+    }
+
+    /**
+     Access an entry that already holds a valid value. Use this to update a valid entry to another valid value.
+     */
+    inline T& operator[](index_type idx){
+        assert(contains(idx));
+        return pages[page_of(idx)]->entries[offset_of(idx)];
+    }
+
+    inline const T& operator[](index_type idx) const{
+        assert(contains(idx));
+        return pages[page_of(idx)]->entries[offset_of(idx)];
+    }
+
+    /**
+     Store a valid value, allocating its page if needed
+     @param idx the index to store at
+     @param value the value to store
+     */
+    inline void insert(index_type idx, T value){
+        assert(value != invalid);
+        const auto p = page_of(idx);
+        if (p >= pages.size()){
+            pages.resize(p + 1);
+        }
+        if (pages[p] == nullptr){
+            std::pmr::polymorphic_allocator<page> alloc(pages.get_allocator());
+            pages[p] = new (alloc.allocate(1)) page();
+            n_pages++;
+        }
+        auto& entry = pages[p]->entries[offset_of(idx)];
+        if (entry == invalid){
+            pages[p]->live++;
+        }
+        entry = value;
+    }
+
+    /**
+     Reset an entry to invalid, freeing its page if that was the last valid entry in it
+     @param idx the index to clear
+     */
+    inline void erase(index_type idx){
+        const auto p = page_of(idx);
+        if (p >= pages.size() || pages[p] == nullptr){
+            return;
+        }
+        auto& entry = pages[p]->entries[offset_of(idx)];
+        if (entry != invalid){
+            entry = invalid;
+            if (--pages[p]->live == 0){
+                free_page(pages[p]);
+                n_pages--;
+            }
+        }
+    }
+
+    /**
+     Make room in the page directory for indices below n. Pages themselves are still allocated on first use.
+     */
+    inline void reserve(index_type n){
+        pages.reserve((n + page_size - 1) / page_size);
+    }
+
+    inline void clear(){
+        for(auto& p : pages){
+            if (p != nullptr){
+                free_page(p);
+            }
+        }
+        pages.clear();
+        n_pages = 0;
+    }
+
+    /**
+     @return the number of bytes held by the page directory and the allocated pages
+     */
+    inline size_t allocated_bytes() const{
+        return pages.capacity() * sizeof(typename decltype(pages)::value_type) + n_pages * sizeof(page);
+    }
+};
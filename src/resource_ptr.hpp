@@ -0,0 +1,36 @@
+#pragma once
+#include <memory>
+#include <memory_resource>
+#include <utility>
+
+// destroys an object and gives its memory back to the resource it was allocated from
+template<typename T>
+struct resource_delete{
+    std::pmr::memory_resource* resource = nullptr;
+
+    inline void operator()(T* ptr) const{
+        ptr->~T();
+        std::pmr::polymorphic_allocator<T>(resource).deallocate(ptr, 1);
+    }
+};
+
+/**
+ A std::unique_ptr whose object is allocated from a std::pmr::memory_resource instead of the global heap.
+ Make one with make_resource_ptr.
+ */
+template<typename T>
+using resource_ptr = std::unique_ptr<T, resource_delete<T>>;
+
+template<typename T, typename ... A>
+inline resource_ptr<T> make_resource_ptr(std::pmr::memory_resource* resource, A&& ... args){
+    std::pmr::polymorphic_allocator<T> alloc(resource);
+    auto ptr = alloc.allocate(1);
+    try{
+        new (ptr) T(std::forward<A>(args)...);
+    }
+    catch(...){
+        alloc.deallocate(ptr, 1);
+        throw;
+    }
+    return resource_ptr<T>(ptr, resource_delete<T>{resource});
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <atomic>
+#include <array>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ The Segmented Array is an id-indexed array that grows without moving its elements, so it can be read while another thread grows it.
+ Storage is split into fixed-size segments, found through a directory that covers every 32-bit index and never moves.
+ - Lookups are wait-free: one atomic load of the segment pointer, then an index
+ - Segments are allocated on demand and published with a compare-and-swap. A thread that loses the race frees its copy.
+ - Elements start out zeroed, so a segment costs nothing until its pages are touched.
+   T must be trivially constructible and destructible, and an all-zero T must be a valid empty element.
+ Threads must not access the same element concurrently without synchronizing themselves.
+ @param segment_bits log2 of the elements per segment
+ */
+template<typename T, size_t segment_bits = 16>
+class segmented_array{
+    static_assert(std::is_trivially_default_constructible_v<T> && std::is_trivially_destructible_v<T>, "segmented_array elements are zero-filled, not constructed");
+    constexpr static size_t segment_size = size_t(1) << segment_bits;
+    constexpr static size_t n_segments = size_t(1) << (32 - segment_bits);
+    std::array<std::atomic<T*>, n_segments> segments{};
+
+    constexpr static size_t segment_of(size_t idx){
+        return idx >> segment_bits;
+    }
+
+    constexpr static size_t offset_of(size_t idx){
+        return idx & (segment_size - 1);
+    }
+
+    inline T* allocate_segment(size_t segment){
+        auto fresh = static_cast<T*>(std::calloc(segment_size, sizeof(T)));
+        if (fresh == nullptr){
+            throw std::bad_alloc();
+        }
+        T* expected = nullptr;
+        if (!segments[segment].compare_exchange_strong(expected, fresh, std::memory_order_acq_rel, std::memory_order_acquire)){
+            std::free(fresh);     // another thread published this segment first
+            return expected;
+        }
+        return fresh;
+    }
+
+public:
+    typedef size_t index_type;
+
+    segmented_array() = default;
+    segmented_array(const segmented_array&) = delete;
+
+    ~segmented_array(){
+        for(auto& segment : segments){
+            std::free(segment.load());
+        }
+    }
+
+    // the element must be in a segment that has been allocated, by reserve or grow.
+    // Whatever made the element's index known to this thread ordered the segment's publication before this read, so a relaxed load suffices.
+    inline T& operator[](index_type idx){
+        return segments[segment_of(idx)].load(std::memory_order_relaxed)[offset_of(idx)];
+    }
+
+    // @return true if the element's segment has been allocated
+    inline bool contains(index_type idx) const{
+        return segment_of(idx) < n_segments && segments[segment_of(idx)].load(std::memory_order_acquire) != nullptr;
+    }
+
+    // allocate the segment of an element, if it does not have one yet
+    inline T& grow(index_type idx){
+        auto ptr = segments[segment_of(idx)].load(std::memory_order_acquire);
+        if (ptr == nullptr){
+            ptr = allocate_segment(segment_of(idx));
+        }
+        return ptr[offset_of(idx)];
+    }
+
+    // allocate the segments of the first n elements
+    inline void reserve(size_t n){
+        for(size_t segment = 0; segment < n_segments && (segment << segment_bits) < n; segment++){
+            if (segments[segment].load(std::memory_order_acquire) == nullptr){
+                allocate_segment(segment);
+            }
+        }
+    }
+};
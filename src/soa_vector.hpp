@@ -0,0 +1,217 @@
+#pragma once
+#include <vector>
+#include <tuple>
+#include <utility>
+#include <type_traits>
+#include <memory_resource>
+
+/**
+ Specialize this to store a component type as a structure of arrays, with each listed field in its own column.
+ The type must be default-constructible, and every field that should survive storage must be listed.
+ Example:
+ template<> struct SoALayout<Position>{
+    static constexpr auto fields = std::make_tuple(&Position::x, &Position::y, &Position::z);
+ };
+ */
+template<typename T>
+struct SoALayout;
+
+template<typename T, typename = void>
+struct is_soa : std::false_type{};
+
+template<typename T>
+struct is_soa<T, std::void_t<decltype(SoALayout<T>::fields)>> : std::true_type{};
+
+template<typename T>
+constexpr bool is_soa_v = is_soa<T>::value;
+
+namespace soa_detail{
+    template<typename M>
+    struct member_value;
+
+    template<typename C, typename F>
+    struct member_value<F C::*>{
+        using type = F;
+    };
+
+    template<typename M>
+    using member_value_t = typename member_value<M>::type;
+
+    template<typename T>
+    using fields_t = std::remove_const_t<decltype(SoALayout<T>::fields)>;
+
+    // @return the position of a member pointer in the type's field list
+    template<typename T, auto member, size_t I = 0>
+    constexpr size_t field_index(){
+        static_assert(I < std::tuple_size_v<fields_t<T>>, "This member is not one of the SoALayout fields");
+        if constexpr (I < std::tuple_size_v<fields_t<T>>){
+            constexpr auto field = std::get<I>(SoALayout<T>::fields);
+            if constexpr (std::is_same_v<std::remove_const_t<decltype(field)>, decltype(member)>){
+                if constexpr (field == member){
+                    return I;
+                }
+                else{
+                    return field_index<T, member, I + 1>();
+                }
+            }
+            else{
+                return field_index<T, member, I + 1>();
+            }
+        }
+        else{
+            return I;
+        }
+    }
+}
+
+/**
+ A reference to one element of an SoA component, made of a pointer to each of its fields.
+ Read and write the fields with get<&T::field>(), or copy the whole component in and out with load and store.
+ */
+template<typename T, typename fields = soa_detail::fields_t<T>>
+class soa_ref;
+
+template<typename T, typename ... M>
+class soa_ref<T, std::tuple<M...>>{
+    std::tuple<soa_detail::member_value_t<M>*...> ptrs;
+
+    template<size_t ... I>
+    static inline auto pointers_into(T& value, std::index_sequence<I...>){
+        return std::tuple<soa_detail::member_value_t<M>*...>{&(value.*std::get<I>(SoALayout<T>::fields))...};
+    }
+
+public:
+    soa_ref(soa_detail::member_value_t<M>* ... ptrs) : ptrs(ptrs...){}
+
+    // refer to the fields of a whole component
+    explicit soa_ref(T& value) : ptrs(pointers_into(value, std::index_sequence_for<M...>{})){}
+
+    template<auto member>
+    inline auto& get() const{
+        return *std::get<soa_detail::field_index<T, member>()>(ptrs);
+    }
+
+    // @return a copy of the component, gathered from its columns
+    inline T load() const{
+        T value{};
+        load_into(value, std::index_sequence_for<M...>{});
+        return value;
+    }
+
+    // scatter a component into its columns
+    inline void store(const T& value) const{
+        store_from(value, std::index_sequence_for<M...>{});
+    }
+
+    inline operator T() const{
+        return load();
+    }
+
+    inline const soa_ref& operator=(const T& value) const{
+        store(value);
+        return *this;
+    }
+
+private:
+    template<size_t ... I>
+    inline void load_into(T& value, std::index_sequence<I...>) const{
+        ((value.*std::get<I>(SoALayout<T>::fields) = *std::get<I>(ptrs)), ...);
+    }
+
+    template<size_t ... I>
+    inline void store_from(const T& value, std::index_sequence<I...>) const{
+        ((*std::get<I>(ptrs) = value.*std::get<I>(SoALayout<T>::fields)), ...);
+    }
+};
+
+// how a component is referred to: a plain reference, or an soa_ref for SoA components
+template<typename T, bool = is_soa_v<T>>
+struct component_ref{
+    using type = T&;
+};
+
+template<typename T>
+struct component_ref<T, true>{
+    using type = soa_ref<T>;
+};
+
+template<typename T>
+using component_ref_t = typename component_ref<T>::type;
+
+/**
+ The SoA Vector stores the fields of its elements in one column each, so that a loop over one field reads contiguous memory.
+ Like unordered_vector, elements are erased by moving the last element into the hole. Indexing returns an soa_ref.
+ */
+template<typename T, typename fields = soa_detail::fields_t<T>>
+class soa_vector;
+
+template<typename T, typename ... M>
+class soa_vector<T, std::tuple<M...>>{
+    std::tuple<std::pmr::vector<soa_detail::member_value_t<M>>...> columns;
+
+    template<size_t ... I>
+    inline void push(T&& value, std::index_sequence<I...>){
+        (std::get<I>(columns).push_back(std::move(value.*std::get<I>(SoALayout<T>::fields))), ...);
+    }
+
+    template<size_t ... I>
+    inline soa_ref<T> at(size_t idx, std::index_sequence<I...>){
+        return soa_ref<T>(std::get<I>(columns).data() + idx...);
+    }
+
+public:
+    typedef size_t index_type;
+    typedef size_t size_type;
+
+    soa_vector(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) : columns(std::pmr::vector<soa_detail::member_value_t<M>>(resource)...){}
+
+    /**
+     Construct an element, and move each of its fields into its column
+     @return a reference to the emplaced item
+     */
+    template<typename ... A>
+    inline soa_ref<T> emplace(A&& ... args){
+        T value(std::forward<A>(args)...);
+        push(std::move(value), std::index_sequence_for<M...>{});
+        return (*this)[size() - 1];
+    }
+
+    inline soa_ref<T> operator[](index_type idx){
+        return at(idx, std::index_sequence_for<M...>{});
+    }
+
+    // erase by index. Complexity is O(1).
+    inline void erase_at(index_type idx){
+        std::apply([&](auto& ... column){
+            ((column[idx] = std::move(column.back()), column.pop_back()), ...);
+        }, columns);
+    }
+
+    inline void swap_elements(index_type a, index_type b){
+        std::apply([&](auto& ... column){
+            (std::swap(column[a], column[b]), ...);
+        }, columns);
+    }
+
+    // @return the contiguous column of a field
+    template<auto member>
+    inline auto* column(){
+        return std::get<soa_detail::field_index<T, member>()>(columns).data();
+    }
+
+    inline size_type size() const{
+        return std::get<0>(columns).size();
+    }
+
+    inline void reserve(size_type n){
+        std::apply([&](auto& ... column){
+            (column.reserve(n), ...);
+        }, columns);
+    }
+
+    inline void clear(){
+        std::apply([&](auto& ... column){
+            (column.clear(), ...);
+        }, columns);
+    }
+};
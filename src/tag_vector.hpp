@@ -0,0 +1,50 @@
+#pragma once
+#include <cstddef>
+#include <utility>
+#include <type_traits>
+#include <memory_resource>
+
+/**
+ The Tag Vector stands in for the dense array of an empty type. Every element is the same empty value,
+ so it only keeps a count, and erasing or swapping elements moves nothing.
+ */
+template<typename T>
+class tag_vector{
+    static_assert(std::is_empty_v<T>, "tag_vector is only for empty types");
+    T value;
+    size_t count = 0;
+    
+public:
+    typedef size_t index_type;
+    typedef size_t size_type;
+    
+    tag_vector(std::pmr::memory_resource* = nullptr){}
+    
+    // construct an element, to run any side effects of its constructor, and count it
+    template<typename ... A>
+    inline T& emplace(A&& ... args){
+        (void)T(std::forward<A>(args)...);
+        count++;
+        return value;
+    }
+    
+    inline T& operator[](index_type){
+        return value;
+    }
+    
+    inline void erase_at(index_type){
+        count--;
+    }
+    
+    inline void swap_elements(index_type, index_type){}
+    
+    inline size_type size() const{
+        return count;
+    }
+    
+    inline void reserve(size_type){}
+    
+    inline void clear(){
+        count = 0;
+    }
+};
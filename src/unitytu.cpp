@@ -1,29 +1,203 @@
 #include "Registry.hpp"
 #include "World.hpp"
 #include "Entity.hpp"
+#include <mutex>
+#include <unordered_map>
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
 #define STATIC(a) decltype(a) a
 
-STATIC(Registry::available);
 STATIC(Registry::entityData);
+STATIC(Registry::nextFresh){0};
+STATIC(Registry::reuseOrder){IDReuse::LIFO};
+STATIC(Registry::sharedMtx);
+STATIC(Registry::sharedReleased);
+STATIC(Registry::nShared){0};
 
-entity_t World::CreateEntity(){
-    entity_t id;
-    if (available.size() > 0){
-        id = available.front();
-        available.pop();
+Registry::IDCache::~IDCache(){
+    // link the unused part of the fresh block onto the released slots
+    for (auto index = fresh; index < freshEnd; index++) {
+        entityData.grow(index);
+        PushReleased(*this, index);
     }
-    else{
+    for (auto chain : {recent, older, DetachLowest(*this, lowest.size + unsorted.size)}) {
+        if (chain.size > 0) {
+            GiveShared(chain);
+        }
+    }
+}
+
+size_t World::RegisterComponentType(RavEngine::ctti_t id, std::string_view name){
+    static std::mutex mtx;
+    static std::unordered_map<RavEngine::ctti_t, std::string_view> names;
+    static size_t nextIndex = 0;
+    
+    std::lock_guard<std::mutex> lk(mtx);
+    // each type registers once, so a second registration of a CTTI is a different type with the same hash.
+    // That includes two types with the same name, such as a type in an anonymous namespace defined in two translation units.
+    // Sparse-set worlds keep them apart by index, but archetype storage is keyed by CTTI and would mix them up,
+    // so this is fatal in every build.
+    auto [it, inserted] = names.emplace(id, name);
+    if (!inserted) {
+        std::cerr << "CTTI collision between " << it->second << " and " << name << "\n";
+        std::abort();
+    }
+    return nextIndex++;
+}
+
+entity_t World::CreateLocalID(){
+    entity_t id = available.pop(localToGlobal);
+    if (!EntityIsValid(id)){
         id = localToGlobal.size();
-        localToGlobal.push_back(INVALID_ENTITY);
+        localToGlobal.push_back(INVALID_ENTITY_ID);
     }
+    return id;
+}
+
+entity_t World::ReserveEntities(size_t n){
+    // fresh ids come after the existing ones, once the free slots have been used up
+    const auto n_fresh = n > available.size() ? n - available.size() : 0;
+    localToGlobal.reserve(localToGlobal.size() + n_fresh);
+    if (storageMode == WorldStorage::SparseSet) {
+        signatures.reserve(localToGlobal.size() + n_fresh);
+    }
+    Registry::Reserve(n);
+    return static_cast<entity_t>(localToGlobal.size() + n_fresh - 1);
+}
+
+entity_t World::LocalIDOf(entity_id_t global_id) const{
+    return Registry::entityData[EntityIndex(global_id)].idInWorld;
+}
+
+entity_id_t World::CreateEntity(){
+    auto id = CreateLocalID();
     localToGlobal[id] = Registry::CreateEntity(this, id);
     return localToGlobal[id];
 }
 
+entity_id_t World::CloneEntity(entity_t local_id){
+    // a clone that silently lacks some of the components would be worse than no clone
+    bool copyable = true;
+    if (storageMode == WorldStorage::Archetype) {
+        copyable = archetypes.CanCopy(local_id);
+    }
+    else {
+        EnumerateComponentsOn(local_id, [&](SparseSetErased& sp_erased){
+            copyable = copyable && sp_erased.Ops().copyToWorld != nullptr;
+        });
+    }
+    if (!copyable) {
+        std::cerr << "Cannot clone an entity that has a component which is not copy constructible\n";
+        std::abort();
+    }
+    const auto global_id = CreateEntity();
+    const auto clone_id = LocalIDOf(global_id);
+    if (storageMode == WorldStorage::Archetype) {
+        archetypes.CopyTo(local_id, this, clone_id);
+    }
+    else {
+        EnumerateComponentsOn(local_id, [&](SparseSetErased& sp_erased){
+            sp_erased.Ops().copyToWorld(sp_erased.GetBase(), local_id, this, clone_id);
+        });
+    }
+    return global_id;
+}
+
+void World::Destroy(entity_t local_id){
+    if (HasComponent<Hierarchy>(local_id)) {
+        Unlink(local_id);
+        std::pmr::vector<entity_id_t> subtree(resource);
+        CollectSubtree(local_id, subtree);
+        // the first is the entity itself, which the caller releases
+        for (size_t i = 1; i < subtree.size(); i++) {
+            DestroyOne(LocalIDOf(subtree[i]));
+            Registry::ReleaseEntity(subtree[i]);
+        }
+    }
+    DestroyOne(local_id);
+}
+
+void World::AddSubtreeFrom(World* other, entity_t other_local_id){
+    other->SetParent(other_local_id, INVALID_ENTITY);
+    std::pmr::vector<entity_id_t> subtree(resource);
+    other->CollectSubtree(other_local_id, subtree);
+    // parents first, so that each arrives in its depth bucket after the ones above it
+    for (auto id : subtree) {
+        auto& data = Registry::entityData[EntityIndex(id)];
+        data.idInWorld = AddEntityFrom(other, data.idInWorld);
+        data.world = this;
+    }
+}
+
+void World::Clear(){
+    for (entity_t i = 0; i < localToGlobal.size(); i++) {
+        if (!FreeSlotTraits::is_free(localToGlobal[i])) {
+            RecordEventOnAll(ComponentEvent::Removed, i);
+            Registry::ReleaseEntity(localToGlobal[i]);
+            if (storageMode == WorldStorage::Archetype) {
+                archetypes.DestroyEntity(i);
+            }
+        }
+    }
+    for (auto& sp_erased : componentSets) {
+        if (sp_erased) {
+            sp_erased.Ops().clear(sp_erased.GetBase());
+        }
+    }
+    signatures.clear();
+    localToGlobal.clear();
+    available.clear();
+}
+
+void World::Tick(ThreadPool& pool){
+    const auto tickBegin = std::chrono::steady_clock::now();
+    for (const auto& stage : scheduler.stages) {
+        const auto tick = AdvanceChangeTick();
+        pool.ParallelFor(0, stage.size(), 1, [&](size_t begin, size_t end) {
+            for (auto i = begin; i < end; i++) {
+                auto& system = scheduler.systems[stage[i]];
+                const auto begin_time = std::chrono::steady_clock::now();
+                system.run(*this, system.lastRun);
+                system.duration = std::chrono::steady_clock::now() - begin_time;
+                system.lastRun = tick;
+            }
+        });
+    }
+    scheduler.Report(std::chrono::steady_clock::now() - tickBegin);
+}
+
+void World::DeliverEvents(){
+    std::pmr::vector<entity_id_t> ids(resource);
+    std::pmr::vector<ComponentEvent> events(resource);
+    for (size_t index = 0; index < observers.size(); index++) {
+        if (!observers[index] || observers[index]->ids.empty()) {
+            continue;
+        }
+        // take the queue, observers may record more events while they run
+        std::swap(ids, observers[index]->ids);
+        std::swap(events, observers[index]->events);
+        for (size_t begin = 0; begin < ids.size();) {
+            auto end = begin + 1;
+            while (end < ids.size() && events[end] == events[begin]) {
+                end++;
+            }
+            // look the observers up by index each time, an observer may observe another type and grow the list
+            const auto n_observers = observers[index]->observers[size_t(events[begin])].size();
+            for (size_t i = 0; i < n_observers; i++) {
+                observers[index]->observers[size_t(events[begin])][i](ids.data() + begin, end - begin);
+            }
+            begin = end;
+        }
+        ids.clear();
+        events.clear();
+    }
+}
+
 World::~World() {
     //TODO: destroy all entities 
     for (const auto& e : localToGlobal) {
-        if (EntityIsValid(e)) {
+        if (!FreeSlotTraits::is_free(e)) {
             Registry::ReleaseEntity(e);
         }
     }
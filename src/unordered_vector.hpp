@@ -1,6 +1,7 @@
 #pragma once
 #include <vector>
 #include <algorithm>
+#include <utility>
 
 /**
  The Unordered Vector provides:
@@ -16,6 +17,11 @@ public:
     typedef typename decltype(underlying)::const_iterator const_iterator_type;
     typedef typename decltype(underlying)::size_type index_type;
     typedef typename decltype(underlying)::size_type size_type;
+    
+    unordered_vector() = default;
+    
+    // for allocator-aware vectors, such as std::pmr::vector
+    unordered_vector(const typename vec::allocator_type& alloc) : underlying(alloc){}
 
     /**
      Erase by iterator. Complexity is O(1).
@@ -27,6 +33,10 @@ public:
         return it;
     }
     
+    inline auto get_allocator() const{
+        return underlying.get_allocator();
+    }
+    
     /**
      @return the underlying vector. Do not modify!
      */
@@ -62,8 +72,8 @@ public:
      @note references may become invalid if an item is erased from the container
      */
     template<typename ... A>
-    inline T& emplace(A ... args){
-        underlying.emplace_back(args...);
+    inline T& emplace(A&& ... args){
+        underlying.emplace_back(std::forward<A>(args)...);
         return underlying.back();
     }
     
@@ -2,9 +2,24 @@
 #include "World.hpp"
 #include "Entity.hpp"
 #include "ComponentHandle.hpp"
+#include "paged_sparse_array.hpp"
+#include "CommandBuffer.hpp"
 #include <iostream>
 #include <array>
 #include <chrono>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include <vector>
+#include <utility>
+#include <string>
+#include <memory_resource>
+#include <set>
+#include <random>
+#include <mutex>
+#include <thread>
+#include <cstdlib>
+#include <new>
 
 using namespace std;
 
@@ -16,6 +31,97 @@ struct FloatComponent{
     float value;
 };
 
+struct SelfComponent{
+    entity_id_t id;
+};
+
+struct FrameInfo{
+    int step;
+};
+
+// many distinct component types, for worlds with lots of registered sets
+template<int N>
+struct NumberedComponent : RavEngine::AutoCTTI{
+    int value = N;
+};
+
+// counts its copies, to check that components are moved and not copied on their way into a world
+struct CopyCounter : public RavEngine::AutoCTTI{
+    inline static int copies = 0;
+    std::vector<float> data;
+    
+    CopyCounter(size_t n = 0) : data(n){}
+    CopyCounter(const CopyCounter& other) : data(other.data){
+        copies++;
+    }
+    CopyCounter(CopyCounter&&) noexcept = default;
+    CopyCounter& operator=(const CopyCounter& other){
+        data = other.data;
+        copies++;
+        return *this;
+    }
+    CopyCounter& operator=(CopyCounter&&) noexcept = default;
+};
+
+// a component that owns heap memory
+struct MeshComponent : public RavEngine::AutoCTTI{
+    std::string name;
+    std::vector<float> vertices;
+    
+    MeshComponent(std::string&& name, std::vector<float>&& vertices) : name(std::move(name)), vertices(std::move(vertices)){}
+};
+
+struct AoSPosition{
+    float x, y, z, w;
+};
+
+// the same data, stored one column per field
+struct SoAPosition{
+    float x, y, z, w;
+};
+
+template<>
+struct SoALayout<SoAPosition>{
+    static constexpr auto fields = std::make_tuple(&SoAPosition::x, &SoAPosition::y, &SoAPosition::z, &SoAPosition::w);
+};
+
+// every allocation from the global heap, to check that a world allocates only from its own memory resource
+static std::atomic<size_t> globalAllocations = 0;
+
+void* operator new(size_t size){
+    globalAllocations++;
+    if (auto ptr = std::malloc(size > 0 ? size : 1)){
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept{
+    std::free(ptr);
+}
+
+// forwards to the default heap, keeping count of the bytes that are still allocated
+struct CountingResource : public std::pmr::memory_resource{
+    size_t outstanding = 0, allocations = 0;
+    
+    void* do_allocate(size_t bytes, size_t alignment) override{
+        outstanding += bytes;
+        allocations++;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+    void do_deallocate(void* ptr, size_t bytes, size_t alignment) override{
+        outstanding -= bytes;
+        std::pmr::new_delete_resource()->deallocate(ptr, bytes, alignment);
+    }
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override{
+        return this == &other;
+    }
+};
+
 struct MyPrototype : public Entity{
     void Create(){
         auto& comp = EmplaceComponent<IntComponent>();
@@ -40,10 +146,16 @@ static auto time(const T& func){
     return chrono::duration_cast<std::chrono::microseconds>(end_time - begin_time);
 }
 
+template<int ... N>
+static void EmplaceNumbered(Entity e, std::integer_sequence<int, N...>){
+    (e.EmplaceComponent<NumberedComponent<N>>(), ...);
+}
+
 int main() {
     // perf tests
-    {
-        World w;
+    for(auto storage : {WorldStorage::SparseSet, WorldStorage::Archetype}){
+        World w(storage);
+        const char* backend = storage == WorldStorage::SparseSet ? "[SparseSet] " : "[Archetype] ";
         constexpr auto n_entities =
 #ifdef _DEBUG
             2'000;
@@ -55,14 +167,14 @@ int main() {
                 w.CreatePrototype<MyExtendedPrototype>();
             }
             });
-        cout << "Spawning " << n_entities << " with 2 components took " << dur.count() << "µs\n";
+        cout << backend << "Spawning " << n_entities << " with 2 components took " << dur.count() << "µs\n";
 
         dur = time([&] {
             w.Filter<IntComponent>([](auto& ic) {
                 ic.value *= 2;
                 });
             });
-        cout << "Single component filter on " << n_entities << " took " << dur.count() << "µs\n";
+        cout << backend << "Single component filter on " << n_entities << " took " << dur.count() << "µs\n";
 
         dur = time([&] {
             w.Filter<IntComponent, FloatComponent>([](auto& ic, auto& fc) {
@@ -70,7 +182,7 @@ int main() {
                 fc.value = ic.value * 6;
                 });
             });
-        cout << "Two-component (worst) filter on " << n_entities << " entities took " << dur.count() << "µs\n";
+        cout << backend << "Two-component (worst) filter on " << n_entities << " entities took " << dur.count() << "µs\n";
 
         dur = time([&] {
             w.Filter<FloatComponent, IntComponent>([](auto& fc, auto& ic) {
@@ -78,7 +190,148 @@ int main() {
                 fc.value = ic.value * 6;
                 });
             });
-        cout << "Two-component (best) filter on " << n_entities << " entities took " << dur.count() << "µs\n";
+        cout << backend << "Two-component (best) filter on " << n_entities << " entities took " << dur.count() << "µs\n";
+        
+        auto serial = time([&] {
+            w.Filter<IntComponent>([](auto& ic) {
+                ic.value *= 2;
+                });
+            });
+        auto parallel = time([&] {
+            w.ParallelFilter<IntComponent>([](auto& ic) {
+                ic.value *= 2;
+                });
+            });
+        cout << backend << "Parallel single component filter on " << n_entities << " took " << parallel.count() << "µs, " << double(serial.count()) / parallel.count() << "x the speed of serial on " << ThreadPool::Shared().GetThreadCount() << " threads\n";
+        
+        serial = time([&] {
+            w.Filter<FloatComponent, IntComponent>([](auto& fc, auto& ic) {
+                ic.value /= 3;
+                fc.value = ic.value * 6;
+                });
+            });
+        parallel = time([&] {
+            w.ParallelFilter<FloatComponent, IntComponent>([](auto& fc, auto& ic) {
+                ic.value /= 3;
+                fc.value = ic.value * 6;
+                });
+            });
+        cout << backend << "Parallel two-component filter on " << n_entities << " took " << parallel.count() << "µs, " << double(serial.count()) / parallel.count() << "x the speed of serial on " << ThreadPool::Shared().GetThreadCount() << " threads\n";
+        
+        dur = time([&] {
+            w.FilterChunks<IntComponent>([](size_t count, IntComponent* ic) {
+                for(size_t i = 0; i < count; i++){
+                    ic[i].value *= 2;
+                }
+                });
+            });
+        cout << backend << "Chunked single component filter on " << n_entities << " took " << dur.count() << "µs\n";
+        
+        dur = time([&] {
+            w.FilterChunks<FloatComponent, IntComponent>([](size_t count, FloatComponent* fc, IntComponent* ic) {
+                for(size_t i = 0; i < count; i++){
+                    ic[i].value /= 3;
+                    fc[i].value = ic[i].value * 6;
+                }
+                });
+            });
+        cout << backend << "Chunked two-component filter on " << n_entities << " entities took " << dur.count() << "µs\n";
+        
+        // per-world state: a component on a singleton entity looked up every iteration, against a resource looked up once
+        auto singleton = w.CreatePrototype<Entity>();
+        singleton.EmplaceComponent<FrameInfo>().step = 1;
+        auto lookup = time([&] {
+            w.Filter<IntComponent>([&](auto& ic) {
+                ic.value += singleton.GetComponent<FrameInfo>().step;
+                });
+            });
+        w.SetResource<FrameInfo>(FrameInfo{1});
+        auto resource = time([&] {
+            w.Filter<IntComponent, Resource<FrameInfo>>([](auto& ic, auto& frame) {
+                ic.value += frame.step;
+                });
+            });
+        cout << backend << "Resource filter on " << n_entities << " took " << resource.count() << "µs, " << double(lookup.count()) / resource.count() << "x the speed of a singleton component lookup\n";
+        
+        w.CreateGroup<IntComponent, FloatComponent>();
+        dur = time([&] {
+            w.Filter<FloatComponent, IntComponent>([](auto& fc, auto& ic) {
+                ic.value /= 3;
+                fc.value = ic.value * 6;
+                });
+            });
+        cout << backend << "Grouped two-component filter on " << n_entities << " entities took " << dur.count() << "µs\n";
+    }
+    // bulk spawning
+    for(auto storage : {WorldStorage::SparseSet, WorldStorage::Archetype}){
+        World w(storage);
+        const char* backend = storage == WorldStorage::SparseSet ? "[SparseSet] " : "[Archetype] ";
+        constexpr auto n_entities =
+#ifdef _DEBUG
+            2'000;
+#else
+            20'000'000;
+#endif
+        auto dur = time([&] {
+            w.CreatePrototypes<MyExtendedPrototype>(n_entities);
+        });
+        cout << backend << "Bulk spawning " << n_entities << " with 2 components took " << dur.count() << "µs\n";
+    }
+    // allocation-heavy components
+    for(auto storage : {WorldStorage::SparseSet, WorldStorage::Archetype}){
+        World w(storage);
+        const char* backend = storage == WorldStorage::SparseSet ? "[SparseSet] " : "[Archetype] ";
+        constexpr auto n_entities =
+#ifdef _DEBUG
+            2'000;
+#else
+            1'000'000;
+#endif
+        auto dur = time([&] {
+            for (int i = 0; i < n_entities; i++) {
+                auto e = w.CreatePrototype<Entity>();
+                e.EmplaceComponent<MeshComponent>(std::string("a mesh name that does not fit in a small string"), std::vector<float>(64, 1.0f));
+            }
+        });
+        cout << backend << "Spawning " << n_entities << " with a heap-owning component took " << dur.count() << "µs\n";
+    }
+    // SoA against AoS layout, updating one field of a four-field component
+    {
+        World w;
+        constexpr auto n_entities =
+#ifdef _DEBUG
+            2'000;
+#else
+            20'000'000;
+#endif
+        auto e = w.CreatePrototype<Entity>();
+        w.CreatePrototypes<Entity>(n_entities, [](Entity& e, size_t i){
+            e.EmplaceComponent<AoSPosition>(AoSPosition{float(i), 0, 0, 1});
+            e.EmplaceComponent<SoAPosition>(SoAPosition{float(i), 0, 0, 1});
+        });
+        auto aos = time([&]{
+            w.Filter<AoSPosition>([](auto& pos){
+                pos.x += pos.w;
+            });
+        });
+        auto soa = time([&]{
+            w.Filter<SoAPosition>([](auto pos){
+                pos.template get<&SoAPosition::x>() += pos.template get<&SoAPosition::w>();
+            });
+        });
+        cout << "Updating one field of " << n_entities << " 4-field components took " << aos.count() << "µs in AoS layout, " << soa.count() << "µs in SoA layout\n";
+        
+        aos = time([&]{
+            w.Filter<AoSPosition>([](auto& pos){
+                pos.x += 1;
+            });
+        });
+        soa = time([&]{
+            w.Filter<SoAPosition>([](auto pos){
+                pos.template get<&SoAPosition::x>() += 1;
+            });
+        });
+        cout << "Incrementing one field of " << n_entities << " 4-field components took " << aos.count() << "µs in AoS layout, " << soa.count() << "µs in SoA layout\n";
     }
     // filter tests
     {
@@ -203,6 +456,1267 @@ int main() {
         });
         cout << "\nAfter moving entities to w1, w1count = " << w1count << ", w2count = " << w2count << "\n";
     }
+    // stale handles
+    {
+        World w;
+        auto e = w.CreatePrototype<MyPrototype>();
+        ComponentHandle<IntComponent> handle(e);
+        assert(handle.IsValid() && handle->value == 5);
+        auto old_id = e.id;
+        e.Destroy();
+        e.Destroy();    // destroying twice is harmless
+        
+        // even if the new entity reuses the slot, it does not reuse the generation
+        auto e2 = w.CreatePrototype<MyPrototype>();
+        assert(!EntityIsValid(old_id) && EntityIsValid(e2.id));
+        assert(!handle.IsValid());
+        assert(handle.operator->() == nullptr);
+        assert(e2.TryGetComponent<FloatComponent>() == nullptr);
+        assert(e2.TryGetComponent<IntComponent>()->value == 5);
+        cout << "A handle to a destroyed entity is " << (handle.IsValid() ? "valid" : "invalid") << " after creating another\n";
+    }
+    // id reuse order
+    {
+        World w;
+        std::array<Entity, 10> entities;
+        for(auto& e : entities){
+            e = w.CreatePrototype<MyPrototype>();
+        }
+        Registry::SetIDReuseOrder(IDReuse::LowestFirst);
+        std::array<entity_t, 3> released{EntityIndex(entities[7].id), EntityIndex(entities[2].id), EntityIndex(entities[5].id)};
+        entities[7].Destroy();
+        entities[2].Destroy();
+        entities[5].Destroy();
+        // there may be lower free ids left by other worlds, but never a higher one first
+        auto previous = w.CreatePrototype<MyPrototype>();
+        assert(EntityIndex(previous.id) <= *std::min_element(released.begin(), released.end()));
+        for(int i = 0; i < 2; i++){
+            auto e = w.CreatePrototype<MyPrototype>();
+            assert(EntityIndex(e.id) > EntityIndex(previous.id));
+            previous = e;
+        }
+        // when a thread releases more than it keeps, the highest go to the shared pool and the lowest stay
+        std::vector<Entity> many;
+        std::vector<entity_t> many_released;
+        for(int i = 0; i < 3000; i++){
+            many.push_back(w.CreatePrototype<MyPrototype>());
+            many_released.push_back(EntityIndex(many.back().id));
+        }
+        std::shuffle(many.begin(), many.end(), std::mt19937(7));
+        for(auto& m : many){
+            m.Destroy();
+        }
+        std::sort(many_released.begin(), many_released.end());
+        for(int i = 0; i < 1000; i++){
+            auto m = w.CreatePrototype<MyPrototype>();
+            assert(EntityIndex(m.id) == many_released[i]);
+        }
+        Registry::SetIDReuseOrder(IDReuse::LIFO);
+        entities[3].Destroy();
+        auto e = w.CreatePrototype<MyPrototype>();
+        assert(EntityIndex(e.id) == EntityIndex(entities[3].id));
+        // switching back sorts what was released in LIFO order
+        std::array<entity_t, 3> lifo_released{EntityIndex(entities[9].id), EntityIndex(entities[4].id), EntityIndex(entities[6].id)};
+        entities[9].Destroy();
+        entities[4].Destroy();
+        entities[6].Destroy();
+        Registry::SetIDReuseOrder(IDReuse::LowestFirst);
+        previous = w.CreatePrototype<MyPrototype>();
+        assert(EntityIndex(previous.id) <= *std::min_element(lifo_released.begin(), lifo_released.end()));
+        for(int i = 0; i < 100; i++){
+            auto next = w.CreatePrototype<MyPrototype>();
+            assert(EntityIndex(next.id) > EntityIndex(previous.id));
+            previous = next;
+        }
+        Registry::SetIDReuseOrder(IDReuse::LIFO);
+        cout << "Lowest-first reuse handed out ids in ascending order, LIFO reuse handed back the last released id\n";
+    }
+    // worlds on different threads creating and destroying entities at the same time
+    {
+        constexpr size_t n_threads = 4, n_entities =
+#ifdef _DEBUG
+            20'000;
+#else
+            1'000'000;
+#endif
+        std::array<std::vector<Entity>, n_threads> alive;
+        std::array<World, n_threads> worlds;
+        auto dur = time([&]{
+            std::vector<std::thread> threads;
+            for(size_t t = 0; t < n_threads; t++){
+                threads.emplace_back([&, t]{
+                    auto& w = worlds[t];
+                    auto& entities = alive[t];
+                    for(size_t i = 0; i < n_entities; i++){
+                        auto e = w.CreatePrototype<MyPrototype>();
+                        e.GetComponent<IntComponent>().value = int(i);
+                        entities.push_back(e);
+                    }
+                    // released ids beyond a thread's own cache go to the shared pool, for any thread to reuse
+                    for(size_t i = 0; i < n_entities; i += 2){
+                        entities[i].Destroy();
+                    }
+                    for(size_t i = 0; i < n_entities; i += 2){
+                        entities[i] = w.CreatePrototype<MyPrototype>();
+                        entities[i].GetComponent<IntComponent>().value = int(i);
+                    }
+                });
+            }
+            for(auto& thread : threads){
+                thread.join();
+            }
+        });
+        std::vector<entity_id_t> ids;
+        for(size_t t = 0; t < n_threads; t++){
+            for(size_t i = 0; i < n_entities; i++){
+                auto& e = alive[t][i];
+                assert(e.IsValid() && e.GetWorld() == &worlds[t]);
+                assert(e.GetComponent<IntComponent>().value == int(i));
+                ids.push_back(EntityIndex(e.id));
+            }
+        }
+        std::sort(ids.begin(), ids.end());
+        assert(std::adjacent_find(ids.begin(), ids.end()) == ids.end());
+        cout << n_threads << " threads each creating " << n_entities << " entities, destroying half and creating them again took " << dur.count() << "µs\n";
+    }
+    // bulk spawning with an initializer
+    for(auto storage : {WorldStorage::SparseSet, WorldStorage::Archetype}){
+        World w(storage);
+        w.CreatePrototypes<MyPrototype>(5'000, [](MyPrototype& e, size_t i){
+            e.GetComponent<IntComponent>().value = i;
+            if (i % 2 == 0){
+                e.EmplaceComponent<FloatComponent>().value = i;
+            }
+        });
+        int count = 0;
+        w.Filter<IntComponent, FloatComponent>([&](auto& ic, auto& fc){
+            assert(ic.value == fc.value);
+            count++;
+        });
+        cout << "Bulk spawning 5000 entities and adding a second component to every other one found " << count << " results\n";
+        assert(count == 2'500);
+    }
+    // deferred structural changes
+    for(auto storage : {WorldStorage::SparseSet, WorldStorage::Archetype}){
+        World w(storage);
+        w.CreatePrototypes<Entity>(100, [](Entity& e, size_t i){
+            e.EmplaceComponent<SelfComponent>().id = e.id;
+            e.EmplaceComponent<IntComponent>().value = i;
+        });
+        
+        // structural changes recorded from inside a filter don't disturb the iteration
+        CommandBuffer buffer;
+        int visited = 0;
+        w.Filter<SelfComponent, IntComponent>([&](auto& self, auto& ic){
+            visited++;
+            switch(ic.value % 10){
+                case 0:
+                    buffer.Destroy(self.id);
+                    break;
+                case 1:
+                    buffer.DestroyComponent<IntComponent>(self.id);
+                    break;
+                case 2:
+                    buffer.Emplace<FloatComponent>(self.id);
+                    break;
+            }
+        });
+        assert(visited == 100);
+        
+        // buffers recorded separately, for example on other threads, can be merged
+        CommandBuffer other;
+        auto created = other.Create<MyPrototype>();
+        other.Emplace<FloatComponent>(created);
+        buffer.Merge(std::move(other));
+        assert(other.Empty());
+        
+        auto result = w.Apply(buffer);
+        assert(buffer.Empty());
+        assert(result.size() == 1 && result[0].HasComponent<FloatComponent>() && result[0].GetComponent<IntComponent>().value == 5);
+        
+        int icount = 0, fcount = 0;
+        w.Filter<IntComponent>([&](auto& ic){
+            icount++;
+        });
+        w.Filter<FloatComponent>([&](auto& fc){
+            fcount++;
+        });
+        cout << "After applying a command buffer, filter yields " << icount << " intcomponents and " << fcount << " floatcomponents\n";
+        assert(icount == 100 - 10 - 10 + 1 && fcount == 10 + 1);
+        
+        // commands on the same entity and type play back in the order they were recorded, across merged buffers too
+        auto e = w.CreatePrototype<MyPrototype>();
+        buffer.DestroyComponent<IntComponent>(e);
+        buffer.Emplace<IntComponent>(e, IntComponent{6});
+        buffer.Emplace<FloatComponent>(e);
+        buffer.DestroyComponent<FloatComponent>(e);
+        other.DestroyComponent<IntComponent>(e);
+        other.Emplace<IntComponent>(e, IntComponent{7});
+        buffer.Merge(std::move(other));
+        w.Apply(buffer);
+        assert(e.GetComponent<IntComponent>().value == 7 && !e.HasComponent<FloatComponent>());
+        icount = 0;
+        w.Filter<IntComponent>([&](auto& ic){
+            icount++;
+        });
+        assert(icount == 100 - 10 - 10 + 1 + 1);
+        
+        // removing a component that is already gone is skipped, and records no event
+        buffer.DestroyComponent<IntComponent>(e);
+        other.DestroyComponent<IntComponent>(e);
+        buffer.Merge(std::move(other));
+        buffer.DestroyComponent<FloatComponent>(e);
+        int removed = 0;
+        w.Observe<IntComponent>(ComponentEvent::Removed, [&](const entity_id_t*, size_t count){
+            removed += count;
+        });
+        w.Apply(buffer);
+        w.DeliverEvents();
+        assert(!e.HasComponent<IntComponent>() && removed == 1);
+    }
+    // query planning
+    {
+        World w;
+        struct Unused{};
+        int count = 0;
+        // neither of these types have been emplaced yet, so this must not throw
+        w.Filter<IntComponent, Unused>([&](auto& ic){
+            count++;
+        });
+        
+        std::array<Entity, 100> entities;
+        for(auto& e : entities){
+            e = w.CreatePrototype<Entity>();
+            e.EmplaceComponent<IntComponent>().value = 1;
+        }
+        // only a few entities have the second component, so it should drive the loop
+        for(int i = 90; i < 100; i += 2){
+            entities[i].EmplaceComponent<FloatComponent>().value = i;
+        }
+        entities[90].DestroyComponent<IntComponent>();
+        
+        w.Filter<IntComponent, FloatComponent>([&](auto& ic, auto& fc){
+            // components arrive in declared order
+            static_assert(std::is_same_v<std::decay_t<decltype(ic)>, IntComponent>);
+            assert(ic.value == 1 && fc.value >= 92);
+            count++;
+        });
+        cout << "Planned 2-filter driven by the smaller set found " << count << " results\n";
+        assert(count == 4);
+    }
+    // owning groups
+    {
+        World w;
+        std::array<Entity, 50> entities;
+        for(int i = 0; i < entities.size(); i++){
+            entities[i] = w.CreatePrototype<Entity>();
+            entities[i].EmplaceComponent<IntComponent>().value = i;
+            if (i % 2 == 0){
+                entities[i].EmplaceComponent<FloatComponent>().value = i;
+            }
+        }
+        w.CreateGroup<IntComponent, FloatComponent>();
+        
+        // join and leave the group after it was created
+        entities[1].EmplaceComponent<FloatComponent>().value = 1;
+        entities[4].DestroyComponent<IntComponent>();
+        entities[6].DestroyComponent<FloatComponent>();
+        entities[8].Destroy();
+        
+        int count = 0;
+        w.Filter<IntComponent, FloatComponent>([&](auto& ic, auto& fc){
+            assert(ic.value == fc.value);
+            count++;
+        });
+        cout << "Grouped 2-filter found " << count << " results\n";
+        assert(count == 25 + 1 - 3);
+        assert(entities[1].GetComponent<FloatComponent>().value == 1);
+        assert(entities[4].GetComponent<FloatComponent>().value == 4);
+        assert(entities[6].GetComponent<IntComponent>().value == 6);
+    }
+    // parallel filter
+    for(auto storage : {WorldStorage::SparseSet, WorldStorage::Archetype}){
+        World w(storage);
+        for(int i = 0; i < 100'000; i++){
+            auto e = w.CreatePrototype<MyExtendedPrototype>();
+            if (i % 3 == 0){
+                e.DestroyComponent<IntComponent>();
+            }
+        }
+        ThreadPool pool(4);
+        std::atomic<int> count = 0;
+        w.ParallelFilter<FloatComponent, IntComponent>([&](auto& fc, auto& ic){
+            count++;
+        }, 1000, pool);
+        cout << "Parallel 2-filter on 4 threads found " << count << " results\n";
+        assert(count == 100'000 - 33'334);
+    }
+    // archetype storage
+    {
+        World w1(WorldStorage::Archetype), w2;
+        
+        std::array<MyExtendedPrototype, 10> entities;
+        for(auto& e : entities){
+            e = w1.CreatePrototype<MyExtendedPrototype>();
+        }
+        entities[3].DestroyComponent<FloatComponent>();
+        assert(!entities[3].HasComponent<FloatComponent>());
+        assert(entities[3].GetComponent<IntComponent>().value == 5);
+        entities[5].Destroy();
+        
+        int count = 0;
+        w1.Filter<IntComponent, FloatComponent>([&](auto& ic, auto& fc){
+            count++;
+        });
+        cout << "Archetype 2-filter after removing one component and one entity found " << count << " results\n";
+        assert(count == 8);
+        
+        // move to a sparse-set world and back again
+        entities[0].MoveTo(w2);
+        entities[3].MoveTo(w2);
+        assert(entities[0].GetWorld() == &w2);
+        assert(entities[0].GetComponent<FloatComponent>().value == 7.5);
+        entities[0].MoveTo(w1);
+        assert(entities[0].GetComponent<IntComponent>().value == 5);
+        
+        int w1count = 0, w2count = 0;
+        w1.Filter<IntComponent>([&](auto& ic){
+            w1count++;
+        });
+        w2.Filter<IntComponent>([&](auto& ic){
+            w2count++;
+        });
+        cout << "After moving archetype entities to a sparse-set world, w1count = " << w1count << ", w2count = " << w2count << "\n";
+        assert(w1count == 8 && w2count == 1);
+    }
+    // destroying entities in a world with many component types
+    {
+        World w;
+        auto registrar = w.CreatePrototype<Entity>();
+        EmplaceNumbered(registrar, std::make_integer_sequence<int, 64>{});
+        
+        constexpr size_t n_entities = 1'000'000;
+        std::vector<MyPrototype> entities(n_entities);
+        for(auto& e : entities){
+            e = w.CreatePrototype<MyPrototype>();
+        }
+        auto dur = time([&]{
+            for(auto& e : entities){
+                e.Destroy();
+            }
+        });
+        cout << "Destroying " << n_entities << " entities with 1 component in a world with 65 component types took " << dur.count() << "µs\n";
+        assert(registrar.HasComponent<NumberedComponent<63>>());
+        assert(registrar.GetComponent<NumberedComponent<40>>().value == 40);
+        int count = 0;
+        w.Filter<IntComponent>([&](auto& ic){
+            count++;
+        });
+        assert(count == 0);
+    }
+    // components are moved, not copied, on their way into and between worlds
+    for(auto storage : {WorldStorage::SparseSet, WorldStorage::Archetype}){
+        World w(storage), w2;
+        CopyCounter::copies = 0;
+        std::vector<Entity> entities;
+        for(int i = 0; i < 100; i++){
+            auto e = w.CreatePrototype<Entity>();
+            e.EmplaceComponent<CopyCounter>(CopyCounter(16));
+            entities.push_back(e);
+        }
+        entities[0].MoveTo(w2);
+        entities[0].MoveTo(w);
+        
+        CommandBuffer buffer;
+        for(int i = 0; i < 100; i++){
+            buffer.Emplace<CopyCounter>(buffer.Create(), CopyCounter(16));
+        }
+        w.Apply(buffer);
+        assert(entities[0].GetComponent<CopyCounter>().data.size() == 16);
+        cout << "Emplacing, moving and applying 200 heap-owning components made " << CopyCounter::copies << " copies\n";
+        assert(CopyCounter::copies == 0);
+    }
+    // worlds that allocate from their own memory resource
+    for(auto storage : {WorldStorage::SparseSet, WorldStorage::Archetype}){
+        CountingResource counter;
+        ThreadPool pool(1);
+        std::vector<float> vertices(3);
+        // anything the world allocates from the default resource instead of its own throws, and the global heap must go untouched
+        auto previous = std::pmr::set_default_resource(std::pmr::null_memory_resource());
+        const size_t globalBefore = globalAllocations;
+        {
+            World w(storage, &counter);
+            size_t added = 0;
+            w.Observe<IntComponent>(ComponentEvent::Added, [&](const entity_id_t*, size_t count){
+                added += count;
+            });
+            w.CreatePrototypes<MyExtendedPrototype>(10'000);
+            auto e = w.CreatePrototype<Entity>();
+            e.EmplaceComponent<MeshComponent>(std::string("mesh"), std::move(vertices));
+            e.EmplaceComponent<IntComponent>();
+            e.DestroyComponent<IntComponent>();
+            w.FilterChunks<IntComponent, FloatComponent>([](size_t count, IntComponent* ic, FloatComponent* fc){
+                for(size_t i = 0; i < count; i++){
+                    fc[i].value = ic[i].value;
+                }
+            });
+            w.ParallelFilter<IntComponent, FloatComponent>([](auto& ic, auto& fc){
+                ic.value++;
+            }, 1024, pool);
+            w.CreateGroup<IntComponent, FloatComponent>();
+            w.DeliverEvents();
+            assert(added == 10'001);
+            e.Destroy();
+            // checked before the world is destroyed, because releasing its ids may hand blocks of them to the Registry's shared pool
+            assert(globalAllocations == globalBefore);
+            assert(counter.allocations > 0 && counter.outstanding > 0);
+            std::pmr::set_default_resource(previous);
+            cout << "A world with 10001 entities holds " << counter.outstanding / 1024 << " KiB in " << counter.allocations << " allocations from its memory resource\n";
+        }
+        assert(counter.outstanding == 0);
+    }
+    // SoA components
+    for(auto storage : {WorldStorage::SparseSet, WorldStorage::Archetype}){
+        World w(storage), w2;
+        std::vector<Entity> entities;
+        for(int i = 0; i < 10; i++){
+            auto e = w.CreatePrototype<Entity>();
+            e.EmplaceComponent<SoAPosition>(SoAPosition{float(i), float(i * 2), 0, 1});
+            entities.push_back(e);
+        }
+        entities[3].DestroyComponent<SoAPosition>();
+        entities[0].Destroy();
+        
+        float sum = 0;
+        int count = 0;
+        w.Filter<SoAPosition>([&](auto pos){
+            pos.template get<&SoAPosition::z>() = pos.template get<&SoAPosition::x>() + pos.template get<&SoAPosition::y>();
+            sum += pos.template get<&SoAPosition::x>();
+            count++;
+        });
+        assert(count == 8 && sum == 45 - 3);
+        
+        SoAPosition p = entities[5].GetComponent<SoAPosition>();
+        assert(p.x == 5 && p.y == 10 && p.z == 15 && p.w == 1);
+        entities[5].GetComponent<SoAPosition>() = SoAPosition{1, 2, 3, 4};
+        entities[5].MoveTo(w2);
+        assert(entities[5].GetComponent<SoAPosition>().load().w == 4);
+        assert(entities[9].GetComponent<SoAPosition>().template get<&SoAPosition::z>() == 27);
+        cout << "SoA component filter found " << count << " results\n";
+    }
+    // cloning and clearing
+    for(auto storage : {WorldStorage::SparseSet, WorldStorage::Archetype}){
+        World w(storage);
+        auto original = w.CreatePrototype<MyExtendedPrototype>();
+        original.GetComponent<IntComponent>().value = 42;
+        auto copy = original.Clone();
+        assert(copy.id != original.id && copy.GetWorld() == &w);
+        assert(copy.GetComponent<IntComponent>().value == 42);
+        assert(copy.GetComponent<FloatComponent>().value == 7.5);
+
+        int count = 0;
+        w.Filter<IntComponent, FloatComponent>([&](auto& ic, auto& fc){
+            count++;
+        });
+        assert(count == 2);
+
+        w.Clear();
+        assert(!original.IsValid() && !copy.IsValid());
+        count = 0;
+        w.Filter<IntComponent>([&](auto& ic){
+            count++;
+        });
+        assert(count == 0);
+        auto fresh = w.CreatePrototype<MyPrototype>();
+        assert(fresh.GetComponent<IntComponent>().value == 5);
+        cout << "Cloned an entity and cleared the world, " << count << " components remain\n";
+    }
+    // chunked iteration over contiguous blocks
+    for(auto storage : {WorldStorage::SparseSet, WorldStorage::Archetype}){
+        World w(storage);
+        constexpr int n_entities = 10'000;
+        w.CreatePrototypes<Entity>(n_entities, [](Entity& e, size_t i){
+            e.EmplaceComponent<SelfComponent>().id = e.id;
+            e.EmplaceComponent<IntComponent>().value = i;
+            if (i % 2 == 0){
+                e.EmplaceComponent<FloatComponent>().value = 1;
+            }
+        });
+        
+        // one type, passed straight from storage
+        long long sum = 0;
+        size_t chunks = 0;
+        w.FilterChunks<IntComponent>([&](size_t count, IntComponent* ic){
+            assert(count > 0 && count <= World::filter_chunk_size);
+            for(size_t i = 0; i < count; i++){
+                sum += ic[i].value;
+                ic[i].value *= 2;
+            }
+            chunks++;
+        });
+        assert(sum == (long long)n_entities * (n_entities - 1) / 2);
+        
+        // several types, gathered into scratch blocks in sparse-set storage and written back afterwards
+        int matched = 0;
+        w.FilterChunks<IntComponent, FloatComponent, SelfComponent>([&](size_t count, IntComponent* ic, FloatComponent* fc, SelfComponent* self, const entity_id_t* owners){
+            for(size_t i = 0; i < count; i++){
+                assert(self[i].id == owners[i]);
+                assert(ic[i].value % 4 == 0);
+                fc[i].value = ic[i].value;
+            }
+            matched += count;
+        });
+        assert(matched == n_entities / 2);
+        w.Filter<IntComponent, FloatComponent>([&](auto& ic, auto& fc){
+            assert(fc.value == ic.value);
+        });
+        
+        // const types are read only, so they are copied into scratch and not written back
+        matched = 0;
+        w.FilterChunks<const IntComponent, FloatComponent>([&](size_t count, const IntComponent* ic, FloatComponent* fc){
+            for(size_t i = 0; i < count; i++){
+                assert(fc[i].value == ic[i].value);
+                fc[i].value = -ic[i].value;
+            }
+            matched += count;
+        });
+        assert(matched == n_entities / 2);
+        w.Filter<IntComponent, FloatComponent>([&](auto& ic, auto& fc){
+            assert(fc.value == -ic.value);
+            fc.value = ic.value;
+        });
+        
+        // an owning group is passed straight from storage too
+        w.CreateGroup<IntComponent, FloatComponent>();
+        matched = 0;
+        w.FilterChunks<IntComponent, FloatComponent>([&](size_t count, IntComponent* ic, FloatComponent* fc, const entity_id_t* owners){
+            for(size_t i = 0; i < count; i++){
+                assert(fc[i].value == ic[i].value);
+                assert(Entity(owners[i]).GetComponent<IntComponent>().value == ic[i].value);
+            }
+            matched += count;
+        });
+        assert(matched == n_entities / 2);
+        cout << "Chunked filter visited " << n_entities << " entities in " << chunks << " chunks\n";
+    }
+    {
+        // the scratch blocks of a gathered chunked filter are kept for the next call
+        CountingResource counter;
+        World w(WorldStorage::SparseSet, &counter);
+        // the driving float set has gaps where entities lack a SelfComponent, so it is gathered too
+        w.CreatePrototypes<Entity>(10'000, [](Entity& e, size_t i){
+            e.EmplaceComponent<IntComponent>().value = 0;
+            if (i % 3 != 0){
+                e.EmplaceComponent<SelfComponent>().id = i;
+            }
+            if (i % 2 == 0){
+                e.EmplaceComponent<FloatComponent>().value = 7.5;
+            }
+        });
+        size_t matched = 0;
+        auto filter = [&]{
+            w.FilterChunks<const SelfComponent, IntComponent, const FloatComponent>([&](size_t count, const SelfComponent* self, IntComponent* ic, const FloatComponent* fc){
+                for(size_t i = 0; i < count; i++){
+                    ic[i].value = self[i].id + fc[i].value;
+                }
+                matched += count;
+            });
+        };
+        filter();
+        const auto allocations = counter.allocations;
+        filter();
+        assert(counter.allocations == allocations);
+        assert(matched == 2 * 3'333);
+        w.Filter<SelfComponent, IntComponent, FloatComponent>([](auto& self, auto& ic, auto& fc){
+            assert(ic.value == int(self.id + fc.value));
+        });
+    }
+    // change detection
+    for(auto storage : {WorldStorage::SparseSet, WorldStorage::Archetype}){
+        World w(storage);
+        std::vector<Entity> entities;
+        for(int i = 0; i < 100; i++){
+            auto e = w.CreatePrototype<Entity>();
+            e.EmplaceComponent<IntComponent>().value = i;
+            if (i % 2 == 0){
+                e.EmplaceComponent<FloatComponent>();
+            }
+            entities.push_back(e);
+        }
+        int added = 0;
+        w.Filter<Added<IntComponent>>([&](auto& ic){
+            added++;
+        });
+        assert(added == 100);
+        
+        // a system that ran at the first tick sees what changed after it
+        const auto firstRun = w.GetChangeTick();
+        w.AdvanceChangeTick();
+        entities[4].GetComponent<IntComponent>().value = -1;
+        entities[4].MarkChanged<IntComponent>();
+        entities[0].Destroy();
+        auto late = w.CreatePrototype<Entity>();
+        late.EmplaceComponent<IntComponent>().value = 1000;
+        
+        int changed = 0;
+        added = 0;
+        w.Filter<Changed<IntComponent>>([&](auto& ic){
+            assert(ic.value == -1 || ic.value == 1000);
+            changed++;
+        }, firstRun);
+        w.Filter<Added<IntComponent>>([&](auto& ic){
+            added++;
+        }, firstRun);
+        assert(changed == 2 && added == 1);
+        
+        // terms can be mixed with plain types, and Mut stamps what it visits
+        const auto secondRun = w.AdvanceChangeTick();
+        int both = 0;
+        w.Filter<Changed<IntComponent>, FloatComponent>([&](auto& ic, auto& fc){
+            assert(ic.value == -1);
+            both++;
+        }, firstRun);
+        assert(both == 1);
+        w.Filter<Mut<FloatComponent>, IntComponent>([&](auto& fc, auto& ic){
+            fc.value = ic.value;
+        });
+        changed = 0;
+        w.Filter<Changed<FloatComponent>>([&](auto& fc){
+            changed++;
+        }, firstRun);
+        assert(changed == 49);
+        changed = 0;
+        w.Filter<Changed<IntComponent>>([&](auto& ic){
+            changed++;
+        }, secondRun);
+        assert(changed == 0);
+        
+        // ticks follow their components when a group reorders the sets
+        w.CreateGroup<IntComponent, FloatComponent>();
+        both = 0;
+        w.Filter<Changed<IntComponent>, FloatComponent>([&](auto& ic, auto& fc){
+            assert(ic.value == -1);
+            both++;
+        }, firstRun);
+        assert(both == 1);
+        cout << "Change detection found " << both << " changed component in a group\n";
+    }
+    // observers keep an index of the entities with a component up to date
+    for(auto storage : {WorldStorage::SparseSet, WorldStorage::Archetype}){
+        World w(storage), w2(storage);
+        std::set<entity_id_t> index, moved;
+        int batches = 0;
+        w.Observe<IntComponent>(ComponentEvent::Added, [&](const entity_id_t* ids, size_t count){
+            index.insert(ids, ids + count);
+            batches++;
+        });
+        w.Observe<IntComponent>(ComponentEvent::Removed, [&](const entity_id_t* ids, size_t count){
+            for(size_t i = 0; i < count; i++){
+                index.erase(ids[i]);
+            }
+        });
+        w.Observe<IntComponent>(ComponentEvent::MovedOut, [&](const entity_id_t* ids, size_t count){
+            for(size_t i = 0; i < count; i++){
+                index.erase(ids[i]);
+            }
+        });
+        w2.Observe<IntComponent>(ComponentEvent::MovedIn, [&](const entity_id_t* ids, size_t count){
+            moved.insert(ids, ids + count);
+        });
+        
+        std::vector<Entity> entities;
+        for(int i = 0; i < 15; i++){
+            auto e = w.CreatePrototype<Entity>();
+            if (i < 10){
+                e.EmplaceComponent<IntComponent>();
+            }
+            e.EmplaceComponent<FloatComponent>();
+            entities.push_back(e);
+        }
+        assert(index.empty());
+        w.DeliverEvents();
+        assert(index.size() == 10 && batches == 1);
+        
+        entities[0].DestroyComponent<IntComponent>();
+        entities[1].Destroy();
+        entities[10].EmplaceComponent<IntComponent>();
+        // removed and added again, in that order
+        entities[2].DestroyComponent<IntComponent>();
+        entities[2].EmplaceComponent<IntComponent>();
+        entities[3].MoveTo(w2);
+        entities[4].Clone();
+        w.DeliverEvents();
+        w2.DeliverEvents();
+        assert(index.size() == 9 && index.count(entities[2].id) && !index.count(entities[3].id));
+        assert(moved.size() == 1 && moved.count(entities[3].id));
+        
+        w.Clear();
+        w.DeliverEvents();
+        assert(index.empty());
+        cout << "Observers kept an index of " << 10 << " entities up to date in " << batches << " batches of additions\n";
+    }
+    // exclusion and optional terms
+    for(auto storage : {WorldStorage::SparseSet, WorldStorage::Archetype}){
+        World w(storage);
+        w.CreatePrototypes<Entity>(100, [](Entity& e, size_t i){
+            e.EmplaceComponent<IntComponent>().value = i;
+            if (i % 2 == 0){
+                e.EmplaceComponent<FloatComponent>().value = i;
+            }
+        });
+        for(int grouped = 0; grouped < 2; grouped++){
+            if (grouped){
+                // the packed prefix of the group is skipped when the other grouped type is excluded
+                w.CreateGroup<IntComponent, FloatComponent>();
+            }
+            int without = 0;
+            w.Filter<IntComponent, Without<FloatComponent>>([&](auto& ic){
+                assert(ic.value % 2 == 1);
+                without++;
+            });
+            assert(without == 50);
+            int optional = 0, present = 0;
+            w.Filter<Optional<FloatComponent>, IntComponent>([&](FloatComponent* fc, auto& ic){
+                assert((fc != nullptr) == (ic.value % 2 == 0));
+                assert(fc == nullptr || fc->value == ic.value);
+                optional++;
+                present += fc != nullptr;
+            });
+            assert(optional == 100 && present == 50);
+        }
+        // a type nobody has excludes nothing
+        int count = 0;
+        w.Filter<IntComponent, Without<CopyCounter>, Optional<CopyCounter>>([&](auto& ic, CopyCounter* cc){
+            assert(cc == nullptr);
+            count++;
+        });
+        assert(count == 100);
+        count = 0;
+        w.Filter<FloatComponent, Without<IntComponent>>([&](auto& fc){
+            count++;
+        });
+        assert(count == 0);
+        cout << "Exclusion and optional terms found " << count << " floats without ints\n";
+    }
+    // tick terms mixed with terms that have no column to read ticks from
+    for(auto storage : {WorldStorage::SparseSet, WorldStorage::Archetype}){
+        World w(storage);
+        w.SetResource<FrameInfo>().step = 2;
+        std::vector<Entity> entities;
+        for(int i = 0; i < 100; i++){
+            auto e = w.CreatePrototype<Entity>();
+            e.EmplaceComponent<IntComponent>().value = i;
+            if (i % 2 == 0){
+                e.EmplaceComponent<FloatComponent>();
+            }
+            entities.push_back(e);
+        }
+        const auto firstRun = w.GetChangeTick();
+        w.AdvanceChangeTick();
+        for(int i = 0; i < 100; i += 5){
+            entities[i].MarkChanged<IntComponent>();
+        }
+        int count = 0;
+        w.Filter<Changed<IntComponent>, Without<FloatComponent>, Resource<FrameInfo>>([&](auto& ic, FrameInfo& frame){
+            assert(ic.value % 10 == 5 && frame.step == 2);
+            count++;
+        }, firstRun);
+        assert(count == 10);
+        count = 0;
+        int present = 0;
+        w.Filter<Added<IntComponent>, Optional<FloatComponent>, Resource<FrameInfo>>([&](auto& ic, FloatComponent* fc, FrameInfo& frame){
+            present += fc != nullptr;
+            count++;
+        });
+        assert(count == 100 && present == 50);
+        w.Filter<Mut<IntComponent>, Without<FloatComponent>, Optional<CopyCounter>, Resource<FrameInfo>>([&](auto& ic, CopyCounter* cc, FrameInfo& frame){
+            ic.value += frame.step;
+        });
+        count = 0;
+        w.Filter<Changed<IntComponent>, Optional<FloatComponent>>([&](auto& ic, FloatComponent* fc){
+            assert(fc == nullptr || ic.value % 10 == 0);
+            count++;
+        }, firstRun);
+        assert(count == 60);
+        cout << "Tick terms with exclusion, optional and resource terms found " << count << " changed ints\n";
+    }
+    // sorting
+    for(auto storage : {WorldStorage::SparseSet, WorldStorage::Archetype}){
+        World w(storage);
+        std::vector<Entity> entities;
+        for(int i = 0; i < 1000; i++){
+            auto e = w.CreatePrototype<Entity>();
+            e.EmplaceComponent<SelfComponent>().id = e.id;
+            const int value = (i * 7919) % 1000;
+            e.EmplaceComponent<IntComponent>().value = value;
+            if (value % 3 == 0){
+                e.EmplaceComponent<FloatComponent>().value = value;
+            }
+            entities.push_back(e);
+        }
+        entities[10].Destroy();
+        entities[20].DestroyComponent<IntComponent>();
+        
+        w.Sort<IntComponent>([](const IntComponent& a, const IntComponent& b){
+            return a.value < b.value;
+        });
+        int last = -1, count = 0;
+        w.Filter<IntComponent, SelfComponent>([&](auto& ic, auto& self){
+            assert(Entity(self.id).GetComponent<IntComponent>().value == ic.value);
+            count++;
+        });
+        assert(count == 998);
+        if (storage == WorldStorage::SparseSet){
+            w.Filter<IntComponent>([&](auto& ic){
+                assert(ic.value > last);
+                last = ic.value;
+            });
+            // floats follow the ints, so a filter over both walks them in step
+            w.SortAs<FloatComponent, IntComponent>();
+            last = -1;
+            w.Filter<FloatComponent>([&](auto& fc){
+                assert(fc.value > last);
+                last = fc.value;
+            });
+        }
+        else{
+            // each archetype is in order on its own
+            w.Filter<IntComponent, Without<FloatComponent>>([&](auto& ic){
+                assert(ic.value > last);
+                last = ic.value;
+            });
+        }
+        cout << "Sorted " << count << " components\n";
+    }
+    // tag components
+    for(auto storage : {WorldStorage::SparseSet, WorldStorage::Archetype}){
+        struct Enemy{};
+        struct Selected{};
+        World w(storage);
+        std::vector<Entity> entities;
+        w.CreatePrototypes<Entity>(999, [&](Entity& e, size_t i){
+            e.EmplaceComponent<IntComponent>().value = i;
+            if (i % 3 == 0){
+                e.EmplaceComponent<Enemy>();
+            }
+            if (i % 5 == 0){
+                e.EmplaceComponent<Selected>();
+            }
+            entities.push_back(e);
+        });
+        // tags only filter, they aren't passed to the callback
+        int count = 0;
+        w.Filter<IntComponent, Enemy>([&](auto& ic){
+            assert(ic.value % 3 == 0);
+            count++;
+        });
+        assert(count == 333);
+        count = 0;
+        w.Filter<Enemy>([&]{
+            count++;
+        });
+        assert(count == 333);
+        count = 0;
+        int selected = 0;
+        w.Filter<Enemy, Optional<Selected>, IntComponent, Without<FloatComponent>>([&](Selected* sel, auto& ic){
+            assert((sel != nullptr) == (ic.value % 5 == 0));
+            selected += sel != nullptr;
+            count++;
+        });
+        assert(count == 333 && selected == 67);
+        
+        entities[0].DestroyComponent<Enemy>();
+        entities[3].Destroy();
+        entities[1].EmplaceComponent<Enemy>();
+        assert(entities[1].HasComponent<Enemy>() && !entities[0].HasComponent<Enemy>());
+        count = 0;
+        w.Filter<Enemy, IntComponent>([&](auto& ic){
+            assert(ic.value % 3 == 0 || ic.value == 1);
+            count++;
+        });
+        assert(count == 332);
+        cout << "Tag filter found " << count << " tagged entities\n";
+    }
+    for(auto storage : {WorldStorage::SparseSet, WorldStorage::Archetype}){
+        // a tag set keeps no dense array and no ticks, and a tag column keeps no ticks
+        struct Tag{};
+        struct Byte{
+            char value;
+        };
+        CountingResource tags, bytes;
+        {
+            World w1(storage, &tags), w2(storage, &bytes);
+            w1.CreatePrototypes<Entity>(100'000, [](Entity& e, size_t){
+                e.EmplaceComponent<Tag>();
+            });
+            w2.CreatePrototypes<Entity>(100'000, [](Entity& e, size_t){
+                e.EmplaceComponent<Byte>();
+            });
+            cout << "100000 tagged entities use " << tags.outstanding / 1024 << " KiB, with a one-byte component " << bytes.outstanding / 1024 << " KiB\n";
+            // the tags keep neither a byte nor ticks per entity, though a chunk still pads its columns
+            assert(tags.outstanding + 100'000 * (storage == WorldStorage::SparseSet ? sizeof(Byte) + sizeof(ComponentTicks) : sizeof(ComponentTicks)) <= bytes.outstanding);
+        }
+    }
+    // resources
+    for(auto storage : {WorldStorage::SparseSet, WorldStorage::Archetype}){
+        World w(storage);
+        w.CreatePrototypes<Entity>(100, [](Entity& e, size_t i){
+            e.EmplaceComponent<IntComponent>().value = i;
+        });
+        // without the resource, the filter visits nothing
+        int count = 0;
+        w.Filter<IntComponent, Resource<FrameInfo>>([&](auto& ic, auto& frame){
+            count++;
+        });
+        assert(count == 0 && !w.HasResource<FrameInfo>() && w.TryGetResource<FrameInfo>() == nullptr);
+        
+        w.SetResource<FrameInfo>().step = 3;
+        assert(w.HasResource<FrameInfo>() && w.GetResource<FrameInfo>().step == 3);
+        w.Filter<Resource<FrameInfo>, IntComponent>([&](FrameInfo& frame, auto& ic){
+            ic.value += frame.step;
+            count++;
+        });
+        w.ParallelFilter<IntComponent, Resource<FrameInfo>>([&](auto& ic, const FrameInfo& frame){
+            ic.value += frame.step;
+        }, 16);
+        assert(count == 100);
+        w.Filter<IntComponent>([&](auto& ic){
+            assert(ic.value >= 6 && ic.value < 106);
+        });
+        
+        // replacing or removing a resource destroys it, and the world destroys the ones it still has
+        int destroyed = 0;
+        struct Tracked : public RavEngine::AutoCTTI{
+            int* destroyed;
+            Tracked(int* destroyed) : destroyed(destroyed){}
+            ~Tracked(){
+                (*destroyed)++;
+            }
+        };
+        {
+            World scoped(storage);
+            scoped.SetResource<Tracked>(&destroyed);
+            scoped.SetResource<Tracked>(&destroyed);
+            assert(destroyed == 1);
+            scoped.RemoveResource<Tracked>();
+            assert(destroyed == 2 && !scoped.HasResource<Tracked>());
+            scoped.SetResource<Tracked>(&destroyed);
+            scoped.Clear();
+            assert(scoped.HasResource<Tracked>());
+        }
+        assert(destroyed == 3);
+        // each world has its own
+        assert(w.GetResource<FrameInfo>().step == 3);
+        cout << "Resource filter visited " << count << " entities\n";
+    }
+    // parent/child hierarchy
+    for(auto storage : {WorldStorage::SparseSet, WorldStorage::Archetype}){
+        World w(storage), other(storage);
+        auto make = [&](World& world, int value){
+            auto e = world.CreatePrototype<Entity>();
+            e.EmplaceComponent<IntComponent>().value = value;
+            return e;
+        };
+        auto children = [](Entity e){
+            int n = 0;
+            e.ForEachChild([&](Entity){
+                n++;
+            });
+            return n;
+        };
+        // root - a - c
+        //      |   \ d - e
+        //      \ b
+        auto root = make(w, 0), a = make(w, 1), b = make(w, 2), c = make(w, 3), d = make(w, 4), e = make(w, 5);
+        e.SetParent(d);
+        d.SetParent(a);
+        c.SetParent(a);
+        a.SetParent(root);
+        b.SetParent(root);
+        assert(a.GetParent().id == root.id && e.GetParent().id == d.id && !root.GetParent().IsValid());
+        assert(children(root) == 2 && children(a) == 2 && children(e) == 0);
+        assert(e.GetComponent<Hierarchy>().depth == 3 && b.GetComponent<Hierarchy>().depth == 1);
+        
+        // a cloned entity starts outside of the hierarchy
+        auto clone = d.Clone();
+        assert(!clone.HasComponent<Hierarchy>() && children(a) == 2);
+        clone.Destroy();
+        
+        // move a under b, and e to the top
+        a.SetParent(b);
+        e.RemoveParent();
+        assert(children(root) == 1 && children(b) == 1 && children(d) == 0);
+        assert(a.GetComponent<Hierarchy>().depth == 2 && d.GetComponent<Hierarchy>().depth == 3 && e.GetComponent<Hierarchy>().depth == 0);
+        
+        // moving a subtree takes its descendants, and leaves its parent behind
+        a.MoveTo(other);
+        assert(children(b) == 0 && a.GetWorld() == &other && c.GetWorld() == &other && d.GetWorld() == &other);
+        assert(!a.GetParent().IsValid() && a.GetComponent<Hierarchy>().depth == 0 && d.GetComponent<Hierarchy>().depth == 1 && children(a) == 2);
+        
+        // destroying an entity destroys its subtree
+        a.Destroy();
+        assert(!a.IsValid() && !c.IsValid() && !d.IsValid());
+        root.Destroy();
+        assert(!b.IsValid() && e.IsValid());
+    }
+    {
+        // parents are visited before their children, so one pass propagates a value down every branch
+        World w;
+        constexpr int n_nodes =
+#ifdef _DEBUG
+            2'000;
+#else
+            1'000'000;
+#endif
+        std::vector<Entity> nodes;
+        std::mt19937 rng(42);
+        for(int i = 0; i < n_nodes; i++){
+            auto e = w.CreatePrototype<Entity>();
+            e.EmplaceComponent<IntComponent>().value = 1;
+            e.EmplaceComponent<FloatComponent>().value = 0;
+            // parents always have a lower index, so the tree cannot have cycles
+            if (i > 0 && rng() % 8 != 0){
+                e.SetParent(nodes[rng() % i]);
+            }
+            nodes.push_back(e);
+        }
+        // some reparenting and pruning, which must keep the order
+        for(int i = 0; i < n_nodes / 10; i++){
+            const auto child = 1 + rng() % (n_nodes - 1);
+            if (nodes[child].IsValid()){
+                const auto parent = rng() % child;
+                if (!nodes[parent].IsValid()){
+                    nodes[child].RemoveParent();
+                }
+                else{
+                    nodes[child].SetParent(nodes[parent]);
+                }
+            }
+        }
+        for(int i = 0; i < 20; i++){
+            nodes[rng() % n_nodes].Destroy();
+        }
+        auto dur = time([&]{
+            w.Filter<Hierarchy, IntComponent, FloatComponent>([](const Hierarchy& h, auto& ic, auto& fc){
+                fc.value = ic.value + (h.parent != INVALID_ENTITY_ID ? Entity(h.parent).GetComponent<FloatComponent>().value : 0);
+            });
+        });
+        int count = 0;
+        w.Filter<Hierarchy, FloatComponent>([&](const Hierarchy& h, auto& fc){
+            assert(fc.value == h.depth + 1);
+            count++;
+        });
+        cout << "Propagated through a hierarchy of " << count << " entities in " << dur.count() << "µs\n";
+    }
+    // systems
+    for(auto storage : {WorldStorage::SparseSet, WorldStorage::Archetype}){
+        World w(storage);
+        ThreadPool pool(2);
+        std::vector<Entity> entities;
+        w.CreatePrototypes<Entity>(100, [&](Entity& e, size_t i){
+            e.EmplaceComponent<IntComponent>().value = i;
+            e.EmplaceComponent<FloatComponent>().value = i;
+            entities.push_back(e);
+        });
+        std::mutex mtx;
+        std::vector<std::string> order;
+        auto log = [&](const char* name){
+            std::lock_guard<std::mutex> lk(mtx);
+            order.push_back(name);
+        };
+        // these two touch different types, so they run at the same time: each waits for the other to start
+        std::atomic<int> started = 0;
+        bool overlapped = true;
+        auto meet = [&]{
+            started++;
+            const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+            while(started.load() % 2 != 0 && std::chrono::steady_clock::now() < deadline){
+                std::this_thread::yield();
+            }
+            if (started.load() % 2 != 0){
+                overlapped = false;
+            }
+        };
+        w.AddSystem<Writes<IntComponent>>("ints", [&](World& world){
+            meet();
+            for(int i = 0; i < 10; i++){
+                entities[i].GetComponent<IntComponent>().value++;
+                entities[i].MarkChanged<IntComponent>();
+            }
+            log("ints");
+        });
+        w.AddSystem<Writes<FloatComponent>>("floats", [&](World& world){
+            meet();
+            world.Filter<FloatComponent>([](auto& fc){
+                fc.value *= 2;
+            });
+            log("floats");
+        });
+        // this one reads what the first one writes, so it waits for it, and sees its changes
+        int changed = 0;
+        w.AddSystem<Reads<Changed<IntComponent>>, Writes<SelfComponent>>("changes", [&](World& world, tick_t since){
+            changed = 0;
+            world.Filter<Changed<IntComponent>>([&](auto& ic){
+                changed++;
+            }, since);
+            log("changes");
+        });
+        // structural changes run alone
+        w.AddSystem<Exclusive>("spawn", [&](World& world){
+            world.CreatePrototype<Entity>().EmplaceComponent<SelfComponent>();
+            log("spawn");
+        });
+        
+        w.Tick(pool);
+        assert(overlapped);
+        assert(order.size() == 4 && order[2] == "changes" && order[3] == "spawn");
+        assert(changed == 100);     // the first run sees every component as changed
+        order.clear();
+        w.Tick(pool);
+        assert(order.size() == 4 && order[2] == "changes" && order[3] == "spawn");
+        assert(changed == 10);      // only the ones the first system marked since then
+        int spawned = 0;
+        w.Filter<SelfComponent>([&](auto&){
+            spawned++;
+        });
+        assert(spawned == 2);
+        
+        const auto& report = w.GetTickReport();
+        assert(report.systems.size() == 4 && report.systems[1].stage == 0 && report.systems[2].stage == 1 && report.systems[3].stage == 2);
+        assert(report.criticalPath.size() >= 2 && report.criticalPath.back() == "spawn" && report.criticalPathTime <= report.tickTime);
+    }
+    {
+        // independent systems over a large world
+        World w;
+        constexpr auto n_entities =
+#ifdef _DEBUG
+            2'000;
+#else
+            1'000'000;
+#endif
+        w.CreatePrototypes<MyExtendedPrototype>(n_entities, [](MyExtendedPrototype& e, size_t i){
+            e.EmplaceComponent<SelfComponent>().id = i;
+        });
+        w.AddSystem<Writes<IntComponent>>("scale ints", [](World& world){
+            world.Filter<IntComponent>([](auto& ic){
+                ic.value = ic.value * 3 + 1;
+            });
+        });
+        w.AddSystem<Writes<FloatComponent>>("scale floats", [](World& world){
+            world.Filter<FloatComponent>([](auto& fc){
+                fc.value = fc.value * 0.5f + 1;
+            });
+        });
+        w.AddSystem<Writes<SelfComponent>>("ids", [](World& world){
+            world.Filter<SelfComponent>([](auto& self){
+                self.id ^= 1;
+            });
+        });
+        double sum = 0;
+        w.AddSystem<Reads<IntComponent, FloatComponent>>("sum", [&](World& world){
+            sum = 0;
+            world.Filter<IntComponent, FloatComponent>([&](auto& ic, auto& fc){
+                sum += ic.value + fc.value;
+            });
+        });
+        w.Tick();
+        w.Tick();
+        const auto& report = w.GetTickReport();
+        cout << "Tick of " << report.systems.size() << " systems on " << n_entities << " entities took " << chrono::duration_cast<chrono::microseconds>(report.tickTime).count() << "µs on " << ThreadPool::Shared().GetThreadCount() << " threads:";
+        for(const auto& system : report.systems){
+            cout << " " << system.name << " " << chrono::duration_cast<chrono::microseconds>(system.duration).count() << "µs,";
+        }
+        cout << " critical path";
+        for(auto name : report.criticalPath){
+            cout << " " << name;
+        }
+        cout << " " << chrono::duration_cast<chrono::microseconds>(report.criticalPathTime).count() << "µs, sum " << sum << "\n";
+    }
+    {
+        // chunked filters in systems of the same stage allocate their scratch at the same time, from a resource that isn't thread safe
+        struct OverlapResource : public CountingResource{
+            std::atomic<int> inside = 0;
+            std::atomic<int> overlaps = 0;
+            
+            void* do_allocate(size_t bytes, size_t alignment) override{
+                if (inside++ != 0){
+                    overlaps++;
+                }
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+                auto ptr = CountingResource::do_allocate(bytes, alignment);
+                inside--;
+                return ptr;
+            }
+            void do_deallocate(void* ptr, size_t bytes, size_t alignment) override{
+                if (inside++ != 0){
+                    overlaps++;
+                }
+                CountingResource::do_deallocate(ptr, bytes, alignment);
+                inside--;
+            }
+        } overlapResource;
+        {
+            World w(WorldStorage::SparseSet, &overlapResource);
+            ThreadPool pool(2);
+            w.CreatePrototypes<Entity>(10'000, [](Entity& e, size_t i){
+                e.EmplaceComponent<IntComponent>().value = i;
+                e.EmplaceComponent<FloatComponent>().value = i;
+                e.EmplaceComponent<SelfComponent>().id = i;
+                e.EmplaceComponent<NumberedComponent<1>>();
+            });
+            w.AddSystem<Writes<IntComponent, FloatComponent>>("int chunks", [](World& world){
+                world.FilterChunks<IntComponent, FloatComponent>([](size_t count, IntComponent* ic, FloatComponent* fc){
+                    for(size_t i = 0; i < count; i++){
+                        fc[i].value = ++ic[i].value;
+                    }
+                });
+            });
+            w.AddSystem<Writes<SelfComponent, NumberedComponent<1>>>("id chunks", [](World& world){
+                world.FilterChunks<SelfComponent, NumberedComponent<1>>([](size_t count, SelfComponent* self, NumberedComponent<1>* nc){
+                    for(size_t i = 0; i < count; i++){
+                        nc[i].value += self[i].id % 2;
+                    }
+                });
+            });
+            for(int i = 0; i < 20; i++){
+                w.Tick(pool);
+            }
+            assert(w.GetTickReport().systems[0].stage == w.GetTickReport().systems[1].stage);
+            w.Filter<IntComponent, FloatComponent, SelfComponent>([](auto& ic, auto& fc, auto& self){
+                assert(ic.value == int(self.id) + 20 && fc.value == ic.value);
+            });
+        }
+        assert(overlapResource.overlaps == 0 && overlapResource.outstanding == 0);
+    }
+    {
+        // joins between sets whose orders have drifted apart become random access
+        World w;
+        constexpr size_t n_entities =
+#ifdef _DEBUG
+            2'000;
+#else
+            2'000'000;
+#endif
+        w.CreatePrototypes<MyExtendedPrototype>(n_entities, [](MyExtendedPrototype& e, size_t i){
+            e.GetComponent<IntComponent>().value = int((i * 2654435761u) % n_entities);
+        });
+        w.Sort<IntComponent>([](const IntComponent& a, const IntComponent& b){
+            return a.value < b.value;
+        });
+        auto join = [&]{
+            return time([&]{
+                w.Filter<IntComponent, FloatComponent>([](auto& ic, auto& fc){
+                    fc.value += ic.value;
+                });
+            });
+        };
+        const auto shuffled = join();
+        const auto sort = time([&]{
+            w.SortAs<FloatComponent, IntComponent>();
+        });
+        const auto sorted = join();
+        cout << "Two-component filter on " << n_entities << " entities in shuffled order took " << shuffled.count() << "µs, " << sorted.count() << "µs after SortAs, which took " << sort.count() << "µs\n";
+    }
     {
         World w;
         auto entities = make_unique<std::array<Entity, 20'000'000>>();
@@ -222,6 +1736,14 @@ int main() {
         });
         cout << "Adding 2 components to " << entities->size() << " entities took " << dur.count() << "µs\n";
         
+        float sum = 0;
+        dur = time([&]{
+            for(auto& entity : *entities){
+                sum += entity.GetComponent<IntComponent>().value + entity.GetComponent<FloatComponent>().value;
+            }
+        });
+        cout << "Getting 2 components on " << entities->size() << " entities took " << dur.count() << "µs (sum " << sum << ")\n";
+        
         dur = time([&]{
             for(auto& entity : *entities){
                 entity.DestroyComponent<IntComponent>();
@@ -250,5 +1772,59 @@ int main() {
         });
         cout << "Destroying " << entities->size() << " entities with no components took " << dur.count() << "µs\n";
     }
+    // sparse array memory: dozens of rarely used component types in a large world
+    {
+        constexpr entity_t n_entities = 20'000'000;
+        constexpr int n_types = 16, per_type = 1'000;
+        
+        size_t flat_bytes = 0;
+        {
+            // the previous layout: one flat vector per type, as long as the highest id stored in it
+            std::vector<std::vector<entity_t>> flat(n_types);
+            auto dur = time([&]{
+                for(int t = 0; t < n_types; t++){
+                    for(entity_t i = 0; i < per_type; i++){
+                        const entity_t id = n_entities - 1 - i * (n_entities / per_type / (t + 1));
+                        if (id >= flat[t].size()){
+                            flat[t].resize(id + 1, INVALID_ENTITY);
+                        }
+                        flat[t][id] = i;
+                    }
+                }
+            });
+            for(const auto& v : flat){
+                flat_bytes += v.capacity() * sizeof(entity_t);
+            }
+            cout << "Flat sparse arrays for " << n_types << " types with " << per_type << " users each use " << flat_bytes / 1024 << " KiB, filling took " << dur.count() << "µs\n";
+        }
+        {
+            std::vector<paged_sparse_array<entity_t, INVALID_ENTITY>> paged(n_types);
+            auto dur = time([&]{
+                for(int t = 0; t < n_types; t++){
+                    for(entity_t i = 0; i < per_type; i++){
+                        const entity_t id = n_entities - 1 - i * (n_entities / per_type / (t + 1));
+                        paged[t].insert(id, i);
+                    }
+                }
+            });
+            size_t paged_bytes = 0;
+            for(const auto& v : paged){
+                paged_bytes += v.allocated_bytes();
+            }
+            cout << "Paged sparse arrays for " << n_types << " types with " << per_type << " users each use " << paged_bytes / 1024 << " KiB (" << double(flat_bytes) / paged_bytes << "x less), filling took " << dur.count() << "µs\n";
+            
+            // pages are returned once they are empty
+            for(int t = 0; t < n_types; t++){
+                for(entity_t i = 0; i < per_type; i++){
+                    paged[t].erase(n_entities - 1 - i * (n_entities / per_type / (t + 1)));
+                }
+            }
+            paged_bytes = 0;
+            for(const auto& v : paged){
+                paged_bytes += v.allocated_bytes();
+            }
+            cout << "After removing every user, the paged sparse arrays use " << paged_bytes / 1024 << " KiB\n";
+        }
+    }
 }
    